@@ -0,0 +1,138 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_ACCUMULATOR
+#define HIST_LIB_ACCUMULATOR
+
+#include "histLib.h"
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Keeps a running sum of per-frame histograms.  With a window size of N the
+//   oldest frame is subtracted when frame N+1 is added, so updating the window
+//   costs O(bins) per frame regardless of N.  A window size of 0 accumulates
+//   without ever removing frames (SubtractHistogram can still be used).
+//-----------------------------------------------------------------------------
+class CHistAccumulator
+{
+  public:
+    // HistLib provides the bin count and compute settings used by AddFrame
+    CHistAccumulator(
+      const CHistLib& HistLib,
+      EHistChannels Channels = HIST_LIB_CHANNELS_VALUE,
+      unsigned WindowSize = 0);
+    ~CHistAccumulator();
+
+    // Changes the window size (clears the accumulator)
+    void SetWindowSize(unsigned WindowSize);
+    unsigned GetWindowSize() const;
+
+    // Removes all frames
+    void Reset();
+
+    //---------------------
+    // Updating the window
+    //---------------------
+
+    // Computes the histogram(s) of a frame and adds them to the window
+    void AddFrame(const cv::Mat& Image);
+
+    // Adds a precomputed value histogram (BinCount x 1)
+    void AddHistogram(const cv::MatND& Hist);
+
+    // Adds precomputed BGR histograms (BinCount x 1 each)
+    void AddHistogram(
+      const cv::MatND& HistB,
+      const cv::MatND& HistG,
+      const cv::MatND& HistR);
+
+    // Subtracts a value histogram from the running sum (does not change the
+    // window contents)
+    void SubtractHistogram(const cv::MatND& Hist);
+
+    // Subtracts BGR histograms from the running sum
+    void SubtractHistogram(
+      const cv::MatND& HistB,
+      const cv::MatND& HistG,
+      const cv::MatND& HistR);
+
+    //---------------------------
+    // Reading the window result
+    //---------------------------
+
+    // Aggregate histogram of a channel as BinCount x 1 CV_32F, ready for
+    // CHistLib::DrawHistogramValue/DrawHistogramBGR
+    void GetHistogram(cv::MatND& Hist, unsigned Channel = 0) const;
+
+    // Number of frames currently in the window
+    unsigned GetFrameCount() const;
+
+    // Number of channels (1 for value, 3 for BGR)
+    unsigned GetChannelCount() const;
+
+    // Total number of samples in the aggregate histogram
+    double GetTotal(unsigned Channel = 0) const;
+
+    // Mean and standard deviation of the aggregate histogram in bin units
+    double GetMean(unsigned Channel = 0) const;
+    double GetStdDev(unsigned Channel = 0) const;
+
+    // Lowest and highest non-empty bin (-1 when the histogram is empty)
+    int GetMinBin(unsigned Channel = 0) const;
+    int GetMaxBin(unsigned Channel = 0) const;
+
+    // Most populated bin (-1 when the histogram is empty)
+    int GetModeBin(unsigned Channel = 0) const;
+
+  private:
+    void Accumulate(const cv::MatND* Hists[], double Sign);
+    void PushFrame(const cv::MatND* Hists[]);
+    const double* GetSum(unsigned Channel) const;
+
+    CHistLib mHistLib;
+    unsigned mBinCount;
+    unsigned mChannels;
+    unsigned mWindowSize;
+
+    // Running sum, one row of mBinCount bins per channel.  Counts are whole
+    // numbers so adding and subtracting them in double precision is exact.
+    std::vector<double> mSum;
+
+    // Ring buffer of the frames in the window, one row per frame holding
+    // mChannels * mBinCount bins
+    cv::Mat mFrames;
+    unsigned mFrameCount;
+    unsigned mNextFrame;
+};
+
+#endif //end #ifndef HIST_LIB_ACCUMULATOR
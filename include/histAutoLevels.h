@@ -0,0 +1,142 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_AUTO_LEVELS
+#define HIST_LIB_AUTO_LEVELS
+
+#include "histAccumulator.h"
+#include "histLib.h"
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Clip normalization (see CHistLib::NormalizeClipImageBGR) for video.  The
+//   value histogram is kept across frames, either exponentially decayed or
+//   over a sliding window of frames, and the clip points are smoothed over
+//   time so they do not jump from frame to frame.  The stretch tables are
+//   only rebuilt when the rounded clip points change, so a steady stream
+//   costs one histogram update and one rescale pass per frame.
+//-----------------------------------------------------------------------------
+class CHistAutoLevels
+{
+  public:
+    // HistLib provides the thread count and the sampling used to count
+    // frames (sampling is a cheap way to cut the counting cost further)
+    CHistAutoLevels(const CHistLib& HistLib, double ClipPercent = 2.0);
+    ~CHistAutoLevels();
+
+    //---------
+    // Setters
+    //---------
+
+    // Percentage of pixels clipped, split evenly between both ends
+    void SetClipPercent(double ClipPercent);
+
+    // Number of frames in the sliding window.  0 selects an exponentially
+    // decayed histogram instead (see SetDecay).  Clears the history.
+    void SetWindowSize(unsigned WindowSize);
+
+    // Weight in [0, 1) an old histogram keeps per frame in decayed mode
+    void SetDecay(double Decay);
+
+    // Weight in [0, 1) the previous clip points keep per frame (0 follows
+    // every frame immediately)
+    void SetSmoothing(double Smoothing);
+
+    //---------
+    // Getters
+    //---------
+    double GetClipPercent() const;
+    unsigned GetWindowSize() const;
+    double GetDecay() const;
+    double GetSmoothing() const;
+
+    // Current (smoothed) clip points of the value channel.  Both are 0 and
+    // 255 before the first frame.
+    void GetClipPoints(double& Low, double& High) const;
+
+    // Forgets all frames
+    void Reset();
+
+    //------------
+    // Processing
+    //------------
+
+    // Counts the value channel of a CV_8UC3/CV_8UC4 frame, updates the clip
+    // points and stretches the frame into FrameNorm (which may be Frame)
+    void Process(const cv::Mat& Frame, cv::Mat& FrameNorm);
+
+    // Same as Process but reuses the value histogram of Frame from an earlier
+    // CHistLib::ComputeHistogramValue call (which must have used 256 bins)
+    // instead of counting the frame again
+    void Process(
+      const cv::Mat& Frame,
+      cv::Mat& FrameNorm,
+      const cv::MatND& Hist);
+
+    // Updates the clip points from a 256 bin value histogram without
+    // stretching a frame
+    void AddHistogram(const cv::MatND& Hist);
+
+    // Stretches a frame with the current clip points
+    void Apply(const cv::Mat& Frame, cv::Mat& FrameNorm);
+
+  private:
+    void FindClipPoints(double& Low, double& High) const;
+    void UpdateScales();
+
+    CHistLib mHistLib;
+    CHistWorkspace mWorkspace;
+    double mClipPercent;
+    double mDecay;
+    double mSmoothing;
+
+    // Sliding window mode
+    CHistAccumulator mWindow;
+
+    // Aggregate value histogram (256 levels)
+    std::vector<double> mHist;
+    bool mHasFrames;
+
+    // Histogram buffers reused from frame to frame
+    cv::MatND mFrameHist;
+    cv::MatND mWindowHist;
+
+    // Smoothed clip points and the rounded ones the tables were built for
+    double mLow;
+    double mHigh;
+    int mTableLow;
+    int mTableHigh;
+    unsigned mScales[256];
+};
+
+#endif //end #ifndef HIST_LIB_AUTO_LEVELS
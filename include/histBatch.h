@@ -0,0 +1,132 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_BATCH
+#define HIST_LIB_BATCH
+
+#include "histLib.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Histograms (and optional plots) of one image of a batch
+//-----------------------------------------------------------------------------
+struct CHistBatchResult
+{
+  // One histogram for the value layout, blue/green/red for the BGR layout
+  std::vector<cv::MatND> Hists;
+
+  // Histogram plot (empty unless plots are enabled)
+  cv::Mat Plot;
+};
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes histograms of many images on a persistent pool of worker
+//   threads.  Images are dealt out largest first and idle workers steal from
+//   the back of busy workers' queues, so images of very different sizes are
+//   balanced across the pool.  Every worker owns a copy of the CHistLib
+//   settings and its own scratch buffers, and results are always returned in
+//   input order.  Only one batch can be processed at a time.
+//-----------------------------------------------------------------------------
+class CHistBatch
+{
+  public:
+    // Callback that provides the next image of a batch.  It is called under a
+    // lock and returns false once there are no more images.
+    typedef std::function<bool (cv::Mat& Image)> CImageSource;
+
+    // ThreadCount 0 uses one worker per hardware thread
+    CHistBatch(
+      const CHistLib& HistLib,
+      EHistChannels Channels = HIST_LIB_CHANNELS_BGR,
+      unsigned ThreadCount = 0);
+    ~CHistBatch();
+
+    // Enables drawing a histogram plot for every image
+    void SetDrawPlots(bool DrawPlots);
+    bool GetDrawPlots() const;
+
+    unsigned GetThreadCount() const;
+
+    // Processes a batch of images, Results[i] belongs to Images[i]
+    void Process(
+      const std::vector<cv::Mat>& Images,
+      std::vector<CHistBatchResult>& Results);
+
+    // Processes images pulled from Source until it returns false.  Results
+    // are in the order the images were returned by Source.
+    void Process(
+      const CImageSource& Source,
+      std::vector<CHistBatchResult>& Results);
+
+  private:
+    struct CWorker;
+
+    void RunBatch();
+    void ClearJobs();
+    void WorkerLoop(unsigned Id);
+    bool NextJob(unsigned Id, size_t& Job);
+    bool NextSourceJob(cv::Mat& Image, CHistBatchResult*& pResult);
+    void RunJob(
+      CWorker& Worker,
+      const cv::Mat& Image,
+      CHistBatchResult& Result);
+
+    EHistChannels mChannels;
+    bool mDrawPlots;
+    std::vector<CWorker*> mWorkers;
+
+    // Batch start/finish signalling
+    std::mutex mLock;
+    std::condition_variable mStart;
+    std::condition_variable mDone;
+    unsigned mGeneration;
+    unsigned mBusy;
+    bool mStop;
+    std::exception_ptr mError;
+
+    // Current batch
+    const std::vector<cv::Mat>* mpImages;
+    std::vector<CHistBatchResult>* mpResults;
+    const CImageSource* mpSource;
+    std::mutex mSourceLock;
+    bool mSourceDone;
+    std::deque<CHistBatchResult> mSourceResults;
+};
+
+#endif //end #ifndef HIST_LIB_BATCH
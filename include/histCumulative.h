@@ -0,0 +1,135 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_CUMULATIVE
+#define HIST_LIB_CUMULATIVE
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Histogram with a prefix sum (cumulative count) per bin.  Building it
+//   costs one pass over the bins, after which quantile, rank and clip point
+//   queries are binary searches instead of linear walks over the counts.
+//   Bins are returned as indices; a bin maps to image values the same way
+//   as in the histogram the counts came from.
+//-----------------------------------------------------------------------------
+class CCumulativeHist
+{
+  public:
+    CCumulativeHist();
+
+    // Builds from BinCount exact counts
+    CCumulativeHist(const unsigned* Counts, unsigned BinCount);
+
+    // Builds from a CV_32F histogram (see SetHistogram)
+    explicit CCumulativeHist(const cv::MatND& Hist);
+
+    ~CCumulativeHist();
+
+    //---------
+    // Setters
+    //---------
+
+    // Replaces the counts with BinCount exact counts
+    void SetCounts(const unsigned* Counts, unsigned BinCount);
+
+    // Replaces the counts with the ones from CHistLib::ComputeCountsValue or
+    // CHistLib::ComputeCountsBGR
+    void SetCounts(const std::vector<uint64>& Counts);
+
+    // Replaces the counts with a single channel CV_32F histogram such as the
+    // ones from the CHistLib::ComputeHistogram* functions.  Bins are rounded
+    // to the nearest count.
+    void SetHistogram(const cv::MatND& Hist);
+
+    //---------
+    // Getters
+    //---------
+    unsigned GetBinCount() const;
+
+    // Number of samples in all bins
+    uint64 GetTotal() const;
+
+    // Number of samples in bin Bin
+    uint64 GetCount(unsigned Bin) const;
+
+    // Number of samples in bins [0, Bin]
+    uint64 GetCumulative(unsigned Bin) const;
+
+    //---------
+    // Queries
+    //---------
+
+    // Lowest bin whose cumulative count is greater than Count, or
+    // GetBinCount() when there is none
+    unsigned FindFirstAbove(uint64 Count) const;
+
+    // Lowest bin whose cumulative count is at least Count, or GetBinCount()
+    // when there is none
+    unsigned FindFirstAtLeast(uint64 Count) const;
+
+    // Lowest bin that holds at least Fraction (in [0, 1]) of the samples at
+    // or below it.  0 gives the lowest and 1 the highest non-empty bin, 0.5
+    // the median.  Returns 0 for an empty histogram.
+    unsigned Quantile(double Fraction) const;
+
+    // Answers Count quantile queries in one call
+    void Quantiles(
+      const double* Fractions,
+      size_t Count,
+      unsigned* pBins) const;
+
+    void Quantiles(
+      const std::vector<double>& Fractions,
+      std::vector<unsigned>& Bins) const;
+
+    // Fraction of the samples in bins [0, Bin] (0 for an empty histogram)
+    double Rank(unsigned Bin) const;
+
+    // Clip points of CHistLib::NormalizeClipImageBGR for ClipCount samples
+    // clipped at each end.  Low is 0 and High is the last bin when that end
+    // needs no clipping.
+    void FindClipPoints(
+      uint64 ClipCount,
+      unsigned& Low,
+      unsigned& High) const;
+
+  private:
+    void Update();
+
+    std::vector<uint64> mCounts;
+    std::vector<uint64> mCumulative;
+};
+
+#endif //end #ifndef HIST_LIB_CUMULATIVE
@@ -0,0 +1,104 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_INTEGRAL
+#define HIST_LIB_INTEGRAL
+
+#include "histLib.h"
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Integral histogram of an image.  It is built once per image and then
+//   returns the histogram of any rectangle with four lookups per bin.
+//
+//   Memory use is (rows / CellSize + 1) * (cols / CellSize + 1) * channels *
+//   bins * 4 bytes, so the bin count (CHistLib::SetBinCount) and the cell size
+//   are the knobs that trade accuracy for memory.  With a CellSize larger than
+//   1 the rectangle corners are snapped to the nearest cell boundary.
+//-----------------------------------------------------------------------------
+class CHistIntegral
+{
+  public:
+    // HistLib provides the bin count used to build the integral histogram
+    CHistIntegral(
+      const CHistLib& HistLib,
+      EHistChannels Channels = HIST_LIB_CHANNELS_VALUE,
+      unsigned CellSize = 1);
+    ~CHistIntegral();
+
+    // Builds the integral histogram of a CV_8UC1, CV_8UC3 or CV_8UC4 image
+    void Build(const cv::Mat& Image);
+
+    // Histogram of a rectangle as BinCount x 1 CV_32F (value layout)
+    void Query(const cv::Rect& Region, cv::MatND& Hist) const;
+
+    // Histograms of a rectangle as BinCount x 1 CV_32F (BGR layout)
+    void Query(
+      const cv::Rect& Region,
+      cv::MatND& HistB,
+      cv::MatND& HistG,
+      cv::MatND& HistR) const;
+
+    // Size of the image the integral histogram was built from
+    cv::Size GetImageSize() const;
+
+    unsigned GetBinCount() const;
+    unsigned GetCellSize() const;
+
+    // Number of bytes used by the integral histogram
+    size_t GetMemorySize() const;
+
+  private:
+    void QueryChannel(
+      const cv::Rect& Region,
+      unsigned Channel,
+      cv::MatND& Hist) const;
+    const unsigned* GetEntry(int CellY, int CellX) const;
+    int SnapToCell(int Coordinate, int GridSize) const;
+
+    unsigned mBinCount;
+    unsigned mChannels;
+    unsigned mCellSize;
+    cv::Size mImageSize;
+
+    // Number of cell boundaries in each direction (cells + 1)
+    int mGridRows;
+    int mGridCols;
+
+    // Entry (y, x) holds the counts of all pixels above and to the left of
+    // cell boundary (y, x), laid out as mChannels rows of mBinCount bins so a
+    // lookup reads one contiguous run of memory
+    std::vector<unsigned> mTable;
+};
+
+#endif //end #ifndef HIST_LIB_INTEGRAL
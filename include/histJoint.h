@@ -0,0 +1,100 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_JOINT
+#define HIST_LIB_JOINT
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+// Colour spaces a joint histogram can be computed in
+enum EHistJointSpace
+{
+  HIST_LIB_JOINT_BGR, // B x G x R
+  HIST_LIB_JOINT_HS,  // Hue x saturation (hue over the full 0..255 range)
+  HIST_LIB_JOINT_AB   // a x b of CIE L*a*b*
+};
+
+// Joint histograms with at most this many cells are counted in a dense
+// scratch table, larger ones are counted in a hash table of the occupied
+// cells
+#define HIST_LIB_JOINT_DENSE_CELLS (1 << 18)
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Joint 2D/3D colour histogram computed in a single pass and stored as
+//   sorted runs of (cell key, count) for the non-empty cells only.  The key of
+//   a cell is its row-major index, e.g. (q0 * Levels + q1) * Levels + q2.
+//   ToSparseMat() and ToDense() convert to the OpenCV containers.
+//-----------------------------------------------------------------------------
+class CHistJoint
+{
+  public:
+    CHistJoint();
+    ~CHistJoint();
+
+    // Computes the joint histogram of a CV_8UC3/CV_8UC4 BGR image with Levels
+    // (2 to 256) quantization levels per axis
+    void Compute(const cv::Mat& Image, EHistJointSpace Space, unsigned Levels);
+
+    EHistJointSpace GetSpace() const;
+    unsigned GetLevels() const;
+
+    // Number of axes (3 for BGR, 2 otherwise)
+    int GetDims() const;
+
+    // Number of non-empty cells
+    size_t GetNonZeroCount() const;
+
+    // Sorted keys of the non-empty cells and their counts
+    const std::vector<unsigned>& GetKeys() const;
+    const std::vector<unsigned>& GetCounts() const;
+
+    // Count of the cell with the given per axis quantization levels
+    unsigned GetCount(const int* Index) const;
+
+    // Converts to an OpenCV hash based sparse histogram (CV_32F)
+    void ToSparseMat(cv::SparseMat& Hist) const;
+
+    // Converts to a dense Levels^dims CV_32F histogram
+    void ToDense(cv::MatND& Hist) const;
+
+  private:
+    unsigned MakeKey(const int* Index) const;
+
+    EHistJointSpace mSpace;
+    unsigned mLevels;
+    std::vector<unsigned> mKeys;
+    std::vector<unsigned> mCounts;
+};
+
+#endif //end #ifndef HIST_LIB_JOINT
@@ -39,7 +39,48 @@
 #define HIST_LIB_COLOR_GREEN  cv::Scalar(0x00, 0xff, 0x00)
 #define HIST_LIB_COLOR_RED    cv::Scalar(0x00, 0x00, 0xff)
 
+// Largest supported number of histogram bins
+#define HIST_LIB_MAX_BINS 65536
+
+// Histograms with more bins than this are merged into wider bins before they
+// are drawn, so plots stay a sensible width
+#define HIST_LIB_MAX_DRAW_BINS 1024
+
+// Channel layouts a histogram can be computed for
+enum EHistChannels
+{
+  HIST_LIB_CHANNELS_VALUE = 1, // Single channel (grayscale or HSV value)
+  HIST_LIB_CHANNELS_BGR   = 3  // Separate blue, green and red histograms
+};
+
+// Pixel sampling used when computing histograms.  Sampling only applies to
+// 8-bit images: 16-bit and float images, masked and YUV histograms always
+// count every pixel.
+enum EHistSampling
+{
+  HIST_LIB_SAMPLE_ALL,     // Count every pixel (exact)
+  HIST_LIB_SAMPLE_STRIDED, // Count pixels on a regular lattice
+  HIST_LIB_SAMPLE_RANDOM   // Count a seeded random subset of pixels
+};
+
+// Layouts of YUV 4:2:0 frames.  A frame is a single (Height * 3 / 2) x Width
+// CV_8UC1 image (the layout cvtColor expects): the full resolution Y plane
+// followed by the half resolution chroma.
+enum EHistYUVLayout
+{
+  HIST_LIB_YUV_NV12, // Y plane, then interleaved U/V rows
+  HIST_LIB_YUV_NV21, // Y plane, then interleaved V/U rows
+  HIST_LIB_YUV_I420, // Y plane, then the U plane, then the V plane
+  HIST_LIB_YUV_YV12  // Y plane, then the V plane, then the U plane
+};
+
+#include "histMask.h"
+#include "histWorkspace.h"
 #include <opencv2/core/core.hpp>
+#include <vector>
+
+// Plane layout of a YUV frame, used internally
+struct CYUVPlanes;
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
@@ -58,6 +99,12 @@ class CHistLib
     void SetAxisColor(cv::Scalar Color);
     void SetBackgroundColor(cv::Scalar Color);
     void SetDrawSpreadOut(bool DrawSpreadOut);
+    void SetThreadCount(unsigned ThreadCount);
+    void SetSampling(EHistSampling Sampling);
+    void SetSampleFraction(double SampleFraction);
+    void SetSampleSeed(unsigned SampleSeed);
+    void SetHistRange(double Low, double High);
+    void SetNormalizeFixedPoint(bool NormalizeFixedPoint);
 
     //---------
     // Getters
@@ -68,6 +115,12 @@ class CHistLib
     cv::Scalar GetAxisColor() const;
     cv::Scalar GetBackgroundColor() const;
     bool GetDrawSpreadOut() const;
+    unsigned GetThreadCount() const;
+    EHistSampling GetSampling() const;
+    double GetSampleFraction() const;
+    unsigned GetSampleSeed() const;
+    void GetHistRange(int Depth, double& Low, double& High) const;
+    bool GetNormalizeFixedPoint() const;
 
     //---------------------
     // Histogram functions
@@ -80,9 +133,168 @@ class CHistLib
       cv::MatND& HistG,
       cv::MatND& HistR);
 
+    // Computes a three channel (BGR) histogram and the estimated error of
+    // every bin (zero unless sampling is enabled and the image is 8-bit)
+    void ComputeHistogramBGR(
+      const cv::Mat& Image,
+      cv::MatND& HistB,
+      cv::MatND& HistG,
+      cv::MatND& HistR,
+      cv::MatND& HistErrorB,
+      cv::MatND& HistErrorG,
+      cv::MatND& HistErrorR);
+
+    // Computes a three channel (BGR) histogram using the buffers of
+    // Workspace instead of allocating temporaries
+    void ComputeHistogramBGR(
+      const cv::Mat& Image,
+      cv::MatND& HistB,
+      cv::MatND& HistG,
+      cv::MatND& HistR,
+      CHistWorkspace& Workspace);
+
     // Computes a single channel (value) histogram
     void ComputeHistogramValue(const cv::Mat& Image, cv::MatND& Hist);
 
+    // Computes a single channel (value) histogram using the buffers of
+    // Workspace instead of allocating temporaries
+    void ComputeHistogramValue(
+      const cv::Mat& Image,
+      cv::MatND& Hist,
+      CHistWorkspace& Workspace);
+
+    // Computes a single channel (value) histogram and the estimated error of
+    // every bin (zero unless sampling is enabled and the image is 8-bit)
+    void ComputeHistogramValue(
+      const cv::Mat& Image,
+      cv::MatND& Hist,
+      cv::MatND& HistError);
+
+    // Computes a three channel (BGR) histogram of the pixels whose 8-bit mask
+    // is non-zero
+    void ComputeHistogramBGRMasked(
+      const cv::Mat& Image,
+      const cv::Mat& Mask,
+      cv::MatND& HistB,
+      cv::MatND& HistG,
+      cv::MatND& HistR);
+
+    // Computes a three channel (BGR) histogram of the pixels whose mask bit
+    // is set
+    void ComputeHistogramBGRMasked(
+      const cv::Mat& Image,
+      const CHistPackedMask& Mask,
+      cv::MatND& HistB,
+      cv::MatND& HistG,
+      cv::MatND& HistR);
+
+    // Computes a single channel (value) histogram of the pixels whose 8-bit
+    // mask is non-zero
+    void ComputeHistogramValueMasked(
+      const cv::Mat& Image,
+      const cv::Mat& Mask,
+      cv::MatND& Hist);
+
+    // Computes a single channel (value) histogram of the pixels whose mask
+    // bit is set
+    void ComputeHistogramValueMasked(
+      const cv::Mat& Image,
+      const CHistPackedMask& Mask,
+      cv::MatND& Hist);
+
+    // Computes a value histogram for every tile of a TilesX x TilesY grid in a
+    // single pass.  Hists is (TilesX * TilesY) x BinCount CV_32F with one row
+    // per tile in row-major order.
+    void ComputeHistogramValueTiles(
+      const cv::Mat& Image,
+      unsigned TilesX,
+      unsigned TilesY,
+      cv::Mat& Hists);
+
+    // Computes BGR histograms for every tile of a TilesX x TilesY grid in a
+    // single pass (same layout as ComputeHistogramValueTiles)
+    void ComputeHistogramBGRTiles(
+      const cv::Mat& Image,
+      unsigned TilesX,
+      unsigned TilesY,
+      cv::Mat& HistsB,
+      cv::Mat& HistsG,
+      cv::Mat& HistsR);
+
+    //--------------------------------
+    // YUV 4:2:0 histogram functions
+    //--------------------------------
+    // These read camera frames directly without converting them to BGR.
+    // The width and the height of the frame must be even.
+
+    // Computes a histogram of the luma (Y) plane, which is the only plane
+    // that is read
+    void ComputeHistogramLumaYUV(
+      const cv::Mat& Image,
+      EHistYUVLayout Layout,
+      cv::MatND& Hist);
+
+    // Computes histograms of the subsampled U and V planes
+    void ComputeHistogramChromaYUV(
+      const cv::Mat& Image,
+      EHistYUVLayout Layout,
+      cv::MatND& HistU,
+      cv::MatND& HistV);
+
+    // Computes a three channel (BGR) histogram of the frame as cvtColor would
+    // convert it, converting a few pixels at a time into a stack buffer
+    void ComputeHistogramBGRYUV(
+      const cv::Mat& Image,
+      EHistYUVLayout Layout,
+      cv::MatND& HistB,
+      cv::MatND& HistG,
+      cv::MatND& HistR);
+
+    // Computes a single channel (value) histogram of the frame as cvtColor
+    // would convert it
+    void ComputeHistogramValueYUV(
+      const cv::Mat& Image,
+      EHistYUVLayout Layout,
+      cv::MatND& Hist);
+
+    //-----------------------
+    // Exact count functions
+    //-----------------------
+    // These count every pixel (the sampling settings are ignored) into
+    // integer bins, which stay exact where float bins lose precision above
+    // 2^24 pixels.  TCount may be ushort, unsigned or uint64; a bin that
+    // receives more pixels than TCount can hold raises CV_StsOutOfRange.
+    // 8-bit images are counted with 16-bit counters that are promoted before
+    // they overflow.
+
+    // Computes exact three channel (BGR) counts with GetBinCount() bins
+    template <typename TCount>
+    void ComputeCountsBGR(
+      const cv::Mat& Image,
+      std::vector<TCount>& CountsB,
+      std::vector<TCount>& CountsG,
+      std::vector<TCount>& CountsR);
+
+    // Computes exact single channel (value) counts with GetBinCount() bins
+    template <typename TCount>
+    void ComputeCountsValue(const cv::Mat& Image, std::vector<TCount>& Counts);
+
+    // Workspace variants: 8-bit images are counted without heap allocations
+    // once the workspace and the outputs have grown to size
+    template <typename TCount>
+    void ComputeCountsBGR(
+      const cv::Mat& Image,
+      std::vector<TCount>& CountsB,
+      std::vector<TCount>& CountsG,
+      std::vector<TCount>& CountsR,
+      CHistWorkspace& Workspace);
+
+    template <typename TCount>
+    void ComputeCountsValue(
+      const cv::Mat& Image,
+      std::vector<TCount>& Counts,
+      CHistWorkspace& Workspace);
+
     // Normalizes and draws a three channel (BGR) histogram
     void DrawHistogramBGR(
       cv::MatND& HistB,
@@ -90,15 +302,45 @@ class CHistLib
       cv::MatND& HistR,
       cv::Mat& HistImage);
 
+    // Normalizes and draws a three channel (BGR) histogram using the buffers
+    // of Workspace
+    void DrawHistogramBGR(
+      cv::MatND& HistB,
+      cv::MatND& HistG,
+      cv::MatND& HistR,
+      cv::Mat& HistImage,
+      CHistWorkspace& Workspace);
+
     // Normalizes and draws a single channel histogram
     void DrawHistogramValue(cv::MatND& Hist, cv::Mat& HistImage);
 
+    // Normalizes and draws a single channel histogram using the buffers of
+    // Workspace
+    void DrawHistogramValue(
+      cv::MatND& Hist,
+      cv::Mat& HistImage,
+      CHistWorkspace& Workspace);
+
     // Computes and draws a three channel (BGR) histogram
     void ComputeAndDrawHistogramBGR(const cv::Mat& ImageBGR, cv::Mat& ImageHist);
 
+    // Computes and draws a three channel (BGR) histogram using the buffers of
+    // Workspace
+    void ComputeAndDrawHistogramBGR(
+      const cv::Mat& ImageBGR,
+      cv::Mat& ImageHist,
+      CHistWorkspace& Workspace);
+
     // Computes and draws a single channel (value) histogram
     void ComputeAndDrawHistogramValue(const cv::Mat& ImageBGR, cv::Mat& ImageHist);
 
+    // Computes and draws a single channel (value) histogram using the buffers
+    // of Workspace
+    void ComputeAndDrawHistogramValue(
+      const cv::Mat& ImageBGR,
+      cv::Mat& ImageHist,
+      CHistWorkspace& Workspace);
+
     // General purpose histogram drawing function (does not normalize input)
     void DrawHistogram(
       const cv::Mat& Hist,
@@ -107,20 +349,207 @@ class CHistLib
     // Draws the x axis of the histogram plot
     void DrawHistBar(cv::Mat& HistImage, unsigned BinCount);
 
+    // Draws the x axis of the histogram plot with a custom last bin label
+    void DrawHistBar(cv::Mat& HistImage, unsigned BinCount, unsigned LastBin);
+
     //-------------------------
     // Normalization functions
     //-------------------------
+    // These stretch the HSV value channel of a CV_8UC3 or CV_8UC4 image while
+    // keeping hue and saturation: every pixel's B, G and R are rescaled by
+    // newV / V in a single pass, without converting to HSV and back.  The
+    // output has the type of the input (alpha is copied).  ImageBGRNorm may
+    // be ImageBGR itself to normalize in place without a copy.  Counting and
+    // rescaling both run in row bands on up to GetThreadCount() threads and
+    // give the same result as the serial code.
+
     // Scale the value channel to the max (withouth clipping)
     void NormalizeImageBGR(const cv::Mat& ImageBGR, cv::Mat& ImageBGRNorm);
 
+    // Scale the value channel to the max using the buffers of Workspace
+    void NormalizeImageBGR(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGRNorm,
+        CHistWorkspace& Workspace);
+
     // Scale the value channel to a target clipping amount
     void NormalizeClipImageBGR(
         const cv::Mat& ImageBGR,
         cv::Mat& ImageBGRNorm,
         double clipPercent = 2.0f);
 
+    // Scale the value channel to a target clipping amount using the buffers
+    // of Workspace
+    void NormalizeClipImageBGR(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGRNorm,
+        double clipPercent,
+        CHistWorkspace& Workspace);
+
+    // Scale B, G and R separately, each to a target clipping amount of its
+    // own histogram (auto white balance / auto levels).  One pass counts all
+    // three channels and one pass rewrites the image: a table lookup by
+    // default, or the SIMD fixed point stretch (ApplyChannelStretch) with
+    // SetNormalizeFixedPoint(true).
+    void NormalizeClipImageBGRPerChannel(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGRNorm,
+        double clipPercent = 2.0f);
+
+    void NormalizeClipImageBGRPerChannel(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGRNorm,
+        double clipPercent,
+        CHistWorkspace& Workspace);
+
+    // Equalizes the histogram of the value channel (hue and saturation are
+    // kept, as for the normalization functions)
+    void EqualizeImageBGR(const cv::Mat& ImageBGR, cv::Mat& ImageBGREq);
+
+    void EqualizeImageBGR(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGREq,
+        CHistWorkspace& Workspace);
+
+    // Contrast limited adaptive histogram equalization (CLAHE) of the value
+    // channel over a TilesX x TilesY grid.  Each tile's histogram is clipped
+    // at ClipLimit times its mean bin count (0 disables clipping) and the
+    // per tile tables are interpolated bilinearly between tile centres.
+    void EqualizeAdaptiveImageBGR(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGREq,
+        unsigned TilesX = 8,
+        unsigned TilesY = 8,
+        double ClipLimit = 2.0);
+
+    void EqualizeAdaptiveImageBGR(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGREq,
+        unsigned TilesX,
+        unsigned TilesY,
+        double ClipLimit,
+        CHistWorkspace& Workspace);
+
+    // Region variants: the stretch is measured on StatsRegion (a face, a
+    // centre crop) and applied to ApplyRegion, which may be the whole image.
+    // Pixels outside ApplyRegion are copied, or left alone in place.
+
+    // Scale the value channel so the values of StatsRegion span the range
+    void NormalizeImageBGR(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGRNorm,
+        const cv::Rect& StatsRegion,
+        const cv::Rect& ApplyRegion);
+
+    void NormalizeImageBGR(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGRNorm,
+        const cv::Rect& StatsRegion,
+        const cv::Rect& ApplyRegion,
+        CHistWorkspace& Workspace);
+
+    // Scale the value channel to a target clipping amount of StatsRegion
+    void NormalizeClipImageBGR(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGRNorm,
+        const cv::Rect& StatsRegion,
+        const cv::Rect& ApplyRegion,
+        double clipPercent = 2.0f);
+
+    void NormalizeClipImageBGR(
+        const cv::Mat& ImageBGR,
+        cv::Mat& ImageBGRNorm,
+        const cv::Rect& StatsRegion,
+        const cv::Rect& ApplyRegion,
+        double clipPercent,
+        CHistWorkspace& Workspace);
+
   private:
     // Helper functions
+    void DrawHistogram(
+      const cv::Mat& Hist,
+      cv::Mat& HistImage,
+      unsigned LastBin);
+
+    bool ReduceForDrawing(const cv::MatND& Hist, cv::MatND& HistReduced);
+
+    void ComputeBGR(
+      const cv::Mat& Image,
+      cv::MatND& HistB,
+      cv::MatND& HistG,
+      cv::MatND& HistR,
+      cv::MatND** ppHistError,
+      CHistWorkspace* pWorkspace);
+
+    void ComputeValue(
+      const cv::Mat& Image,
+      cv::MatND& Hist,
+      cv::MatND* pHistError,
+      CHistWorkspace* pWorkspace);
+
+    void ComputeBGRMasked(
+      const cv::Mat& Image,
+      const cv::Mat* pMask,
+      const CHistPackedMask* pPackedMask,
+      cv::MatND& HistB,
+      cv::MatND& HistG,
+      cv::MatND& HistR);
+
+    void ComputeValueMasked(
+      const cv::Mat& Image,
+      const cv::Mat* pMask,
+      const CHistPackedMask* pPackedMask,
+      cv::MatND& Hist);
+
+    void ComputeWide(
+      const cv::Mat& Image,
+      bool IsBGR,
+      cv::MatND& HistB,
+      cv::MatND* pHistG,
+      cv::MatND* pHistR,
+      CHistWorkspace* pWorkspace);
+
+    CYUVPlanes GetYUVPlanes(
+      const cv::Mat& Image,
+      EHistYUVLayout Layout) const;
+
+    template <typename TCount>
+    void ComputeCounts(
+      const cv::Mat& Image,
+      bool IsBGR,
+      std::vector<TCount>& CountsB,
+      std::vector<TCount>* pCountsG,
+      std::vector<TCount>* pCountsR,
+      CHistWorkspace& Workspace);
+
+    void CountNormalizeValues(
+      const cv::Mat& ImageBGR,
+      const cv::Rect& StatsRegion,
+      unsigned* Counts,
+      CHistWorkspace& Workspace);
+
+    void BuildNormalizeStretch(
+      unsigned Low,
+      unsigned High,
+      uchar* Stretch) const;
+
+    void ApplyNormalizeScales(
+      const cv::Mat& ImageBGR,
+      cv::Mat& ImageBGRNorm,
+      const cv::Rect& ApplyRegion,
+      const unsigned* Scales);
+
+    bool IsSampling() const;
+
+    void ScaleSampledHistogram(
+      cv::MatND& Hist,
+      double Sampled,
+      double Total,
+      cv::MatND* pHistError);
+
+    void CheckTileGrid(const cv::Mat& Image, unsigned TilesX, unsigned TilesY);
+    void FoldTiles(const unsigned* Counts, unsigned Tiles, cv::Mat& Hists);
+
     void DrawHistBins(
       const cv::Mat& Hist,
       cv::Mat& HistImage,
@@ -150,6 +579,13 @@ class CHistLib
     unsigned mSpread;
     bool mDrawXAxis;
     bool mDrawSpreadOut;
+    unsigned mThreadCount;
+    EHistSampling mSampling;
+    double mSampleFraction;
+    unsigned mSampleSeed;
+    double mRangeLow;
+    double mRangeHigh;
+    bool mNormalizeFixedPoint;
     cv::Scalar mHistPlotColor;
     cv::Scalar mHistAxisColor;
     cv::Scalar mHistBackgroundColor;
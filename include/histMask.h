@@ -0,0 +1,86 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_MASK
+#define HIST_LIB_MASK
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+// Number of pixels stored in one word of a packed mask
+#define HIST_LIB_MASK_WORD_BITS 64
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Mask with one bit per pixel.  Bit i of word w in a row covers pixel
+//   x = w * 64 + i.  Rows are padded to whole words and the padding bits are
+//   always clear.  Words that are all zeros (or all ones) let the masked
+//   histogram kernels skip (or count) 64 pixels at once.
+//-----------------------------------------------------------------------------
+class CHistPackedMask
+{
+  public:
+    CHistPackedMask();
+
+    // Packs an 8-bit mask (non-zero pixels are set)
+    explicit CHistPackedMask(const cv::Mat& Mask);
+
+    ~CHistPackedMask();
+
+    // Allocates a mask of the given size with every bit clear
+    void Create(cv::Size Size);
+
+    // Packs a CV_8UC1 mask (non-zero pixels are set)
+    void Pack(const cv::Mat& Mask);
+
+    // Single pixel access, x and y must lie inside the mask
+    void Set(int x, int y, bool Value);
+    bool Get(int x, int y) const;
+
+    // Words of row y (read only, so the padding bits stay clear)
+    const uint64* GetRow(int y) const;
+
+    cv::Size GetSize() const;
+    int GetWordsPerRow() const;
+
+  private:
+    uint64* GetMutableRow(int y);
+
+    cv::Size mSize;
+    int mWordsPerRow;
+    std::vector<uint64> mWords;
+};
+
+// Packs Width bytes of an 8-bit mask row into words (non-zero bytes are set)
+void PackMaskRow(const uchar* pMask, int Width, uint64* pWords);
+
+#endif //end #ifndef HIST_LIB_MASK
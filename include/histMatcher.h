@@ -0,0 +1,159 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_MATCHER
+#define HIST_LIB_MATCHER
+
+#include "histLib.h"
+#include <list>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Histogram matching (specification): remaps the value channel, or each
+//   BGR channel, of an image so that its histogram follows a reference
+//   histogram.  The mapping table of a frame is found by inverting the
+//   reference CDF at the source CDF.  Source CDFs are quantized into a
+//   signature, and the tables of recently seen signatures are kept in a
+//   least recently used cache, so frames of a steady scene only pay for the
+//   histogram count and the table lookup pass.  Tables are built from the
+//   quantized CDF, so the output does not depend on the cache contents.
+//-----------------------------------------------------------------------------
+class CHistMatcher
+{
+  public:
+    // HistLib provides the thread count used for counting and remapping
+    CHistMatcher(const CHistLib& HistLib, unsigned CacheSize = 16);
+    ~CHistMatcher();
+
+    //---------
+    // Setters
+    //---------
+
+    // Reference for MatchValue: a 256 bin CV_32F histogram such as the one
+    // from CHistLib::ComputeHistogramValue.  Clears the value cache.
+    void SetReference(const cv::MatND& Hist);
+
+    // Reference for MatchBGR: one 256 bin CV_32F histogram per channel such
+    // as the ones from CHistLib::ComputeHistogramBGR.  Clears the BGR cache.
+    void SetReference(
+      const cv::MatND& HistB,
+      const cv::MatND& HistG,
+      const cv::MatND& HistR);
+
+    // Sets the value reference, and for CV_8UC3/CV_8UC4 images also the BGR
+    // reference, from the histograms of a reference image
+    void SetReferenceImage(const cv::Mat& Image);
+
+    // Number of tables kept per mode (at least 1).  Clears both caches.
+    void SetCacheSize(unsigned CacheSize);
+
+    // Number of steps the source CDF is quantized to (between 16 and 65535).
+    // Fewer steps give more cache hits at the cost of a coarser mapping.
+    // Clears both caches.
+    void SetSignatureSteps(unsigned Steps);
+
+    //---------
+    // Getters
+    //---------
+    unsigned GetCacheSize() const;
+    unsigned GetSignatureSteps() const;
+
+    // Number of frames whose table came from the cache and number of frames
+    // whose table had to be built since the last ClearCache()
+    void GetCacheStats(size_t& Hits, size_t& Misses) const;
+
+    // Forgets all cached tables
+    void ClearCache();
+
+    //------------
+    // Processing
+    //------------
+
+    // Matches the histogram of a CV_8UC1 image, or the value channel of a
+    // CV_8UC3/CV_8UC4 image, to the value reference.  Colour images are
+    // rescaled by newV / V so hue and saturation are kept.  ImageMatched may
+    // be Image.
+    void MatchValue(const cv::Mat& Image, cv::Mat& ImageMatched);
+
+    // Matches each channel of a CV_8UC3/CV_8UC4 image to its BGR reference
+    // (alpha is copied).  ImageMatched may be Image.
+    void MatchBGR(const cv::Mat& Image, cv::Mat& ImageMatched);
+
+  private:
+    struct CEntry
+    {
+      uint64 Hash;
+      std::vector<ushort> Signature;
+      uchar Luts[3][256];
+      unsigned Scales[256];
+    };
+
+    void SetReferenceCdf(const cv::MatND& Hist, double* pCdf);
+
+    void BuildSignature(
+      const unsigned* Counts,
+      ushort* pSignature) const;
+
+    void BuildLut(
+      const ushort* pSignature,
+      const double* pReferenceCdf,
+      uchar* pLut) const;
+
+    CEntry& FindEntry(
+      std::list<CEntry>& Cache,
+      const std::vector<ushort>& Signature,
+      bool& Found);
+
+    CHistLib mHistLib;
+    unsigned mCacheSize;
+    unsigned mSignatureSteps;
+
+    // Reference CDFs (256 levels, normalized to 1)
+    bool mHasValueReference;
+    bool mHasBGRReference;
+    double mValueCdf[256];
+    double mBGRCdf[3][256];
+
+    // Most recently used entries first
+    std::list<CEntry> mValueCache;
+    std::list<CEntry> mBGRCache;
+    size_t mHits;
+    size_t mMisses;
+
+    // Buffers reused from frame to frame
+    CHistWorkspace mWorkspace;
+    std::vector<ushort> mSignature;
+    cv::Mat mLut;
+};
+
+#endif //end #ifndef HIST_LIB_MATCHER
@@ -0,0 +1,67 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_WORKSPACE
+#define HIST_LIB_WORKSPACE
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Scratch buffers for the CHistLib compute, normalization and drawing
+//   functions.  A caller that keeps one workspace per thread and passes it to
+//   the workspace overloads gets no heap allocations per frame once the
+//   buffers have grown to the frame size (outputs that already have the
+//   right size and type are reused as well).  A workspace must not be used by
+//   two threads at the same time.
+//-----------------------------------------------------------------------------
+class CHistWorkspace
+{
+  public:
+    CHistWorkspace();
+    ~CHistWorkspace();
+
+    // Frees all buffers
+    void Release();
+
+  private:
+    friend class CHistLib;
+    friend class CHistMatcher;
+
+    // Defined next to the kernels that use it
+    struct CBuffers;
+    CBuffers* mpBuffers;
+
+    // Not copyable
+    CHistWorkspace(const CHistWorkspace&);
+    CHistWorkspace& operator=(const CHistWorkspace&);
+};
+
+#endif //end #ifndef HIST_LIB_WORKSPACE
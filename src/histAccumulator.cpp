@@ -0,0 +1,377 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#include "histAccumulator.h"
+#include <cmath>
+using namespace cv;
+using namespace std;
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistAccumulator::CHistAccumulator(
+  const CHistLib& HistLib,
+  EHistChannels Channels,
+  unsigned WindowSize) :
+  mHistLib(HistLib),
+  mBinCount(HistLib.GetBinCount()),
+  mChannels(Channels),
+  mWindowSize(WindowSize),
+  mFrameCount(0),
+  mNextFrame(0)
+{
+  Reset();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistAccumulator::~CHistAccumulator()
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAccumulator::SetWindowSize(unsigned WindowSize)
+{
+  mWindowSize = WindowSize;
+  Reset();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistAccumulator::GetWindowSize() const
+{
+  return mWindowSize;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAccumulator::Reset()
+{
+  mSum.assign(mChannels * mBinCount, 0.0);
+  mFrameCount = 0;
+  mNextFrame = 0;
+
+  if (mWindowSize > 0)
+  {
+    mFrames.create(mWindowSize, mChannels * mBinCount, CV_32F);
+  }
+  else
+  {
+    mFrames.release();
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes the histogram(s) of a frame with the CHistLib kernels and adds
+//   them to the window
+//-----------------------------------------------------------------------------
+void CHistAccumulator::AddFrame(const Mat& Image)
+{
+  if (mChannels == HIST_LIB_CHANNELS_BGR)
+  {
+    MatND HistB;
+    MatND HistG;
+    MatND HistR;
+
+    mHistLib.ComputeHistogramBGR(Image, HistB, HistG, HistR);
+    AddHistogram(HistB, HistG, HistR);
+  }
+  else
+  {
+    MatND Hist;
+
+    mHistLib.ComputeHistogramValue(Image, Hist);
+    AddHistogram(Hist);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAccumulator::AddHistogram(const MatND& Hist)
+{
+  if (mChannels != HIST_LIB_CHANNELS_VALUE)
+  {
+    CV_Error(CV_StsBadArg, "CHistAccumulator::AddHistogram");
+  }
+
+  const MatND* Hists[] = {&Hist};
+  PushFrame(Hists);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAccumulator::AddHistogram(
+  const MatND& HistB,
+  const MatND& HistG,
+  const MatND& HistR)
+{
+  if (mChannels != HIST_LIB_CHANNELS_BGR)
+  {
+    CV_Error(CV_StsBadArg, "CHistAccumulator::AddHistogram");
+  }
+
+  const MatND* Hists[] = {&HistB, &HistG, &HistR};
+  PushFrame(Hists);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAccumulator::SubtractHistogram(const MatND& Hist)
+{
+  if (mChannels != HIST_LIB_CHANNELS_VALUE)
+  {
+    CV_Error(CV_StsBadArg, "CHistAccumulator::SubtractHistogram");
+  }
+
+  const MatND* Hists[] = {&Hist};
+  Accumulate(Hists, -1.0);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAccumulator::SubtractHistogram(
+  const MatND& HistB,
+  const MatND& HistG,
+  const MatND& HistR)
+{
+  if (mChannels != HIST_LIB_CHANNELS_BGR)
+  {
+    CV_Error(CV_StsBadArg, "CHistAccumulator::SubtractHistogram");
+  }
+
+  const MatND* Hists[] = {&HistB, &HistG, &HistR};
+  Accumulate(Hists, -1.0);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Adds (Sign = 1) or subtracts (Sign = -1) one histogram per channel to the
+//   running sum
+//-----------------------------------------------------------------------------
+void CHistAccumulator::Accumulate(const MatND* Hists[], double Sign)
+{
+  for (unsigned c = 0; c < mChannels; ++c)
+  {
+    const MatND& Hist = *Hists[c];
+
+    if ((Hist.type() != CV_32F) || (Hist.total() != mBinCount))
+    {
+      CV_Error(CV_StsUnmatchedSizes, "CHistAccumulator::Accumulate");
+    }
+
+    double* pSum = &mSum[c * mBinCount];
+    for (unsigned i = 0; i < mBinCount; ++i)
+    {
+      pSum[i] += Sign * Hist.at<float>(i);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Adds a frame to the running sum.  When the window is full the oldest
+//   frame is subtracted and its ring buffer slot reused.
+//-----------------------------------------------------------------------------
+void CHistAccumulator::PushFrame(const MatND* Hists[])
+{
+  Accumulate(Hists, 1.0);
+
+  if (mWindowSize == 0)
+  {
+    mFrameCount++;
+    return;
+  }
+
+  float* pFrame = mFrames.ptr<float>(mNextFrame);
+
+  if (mFrameCount == mWindowSize)
+  {
+    for (unsigned i = 0; i < mChannels * mBinCount; ++i)
+    {
+      mSum[i] -= pFrame[i];
+    }
+  }
+  else
+  {
+    mFrameCount++;
+  }
+
+  for (unsigned c = 0; c < mChannels; ++c)
+  {
+    for (unsigned i = 0; i < mBinCount; ++i)
+    {
+      pFrame[c * mBinCount + i] = Hists[c]->at<float>(i);
+    }
+  }
+
+  mNextFrame = (mNextFrame + 1) % mWindowSize;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+const double* CHistAccumulator::GetSum(unsigned Channel) const
+{
+  if (Channel >= mChannels)
+  {
+    CV_Error(CV_StsOutOfRange, "CHistAccumulator::GetSum");
+  }
+
+  return &mSum[Channel * mBinCount];
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAccumulator::GetHistogram(MatND& Hist, unsigned Channel) const
+{
+  const double* pSum = GetSum(Channel);
+
+  Hist.create(mBinCount, 1, CV_32F);
+  for (unsigned i = 0; i < mBinCount; ++i)
+  {
+    Hist.at<float>(i) = (float)pSum[i];
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistAccumulator::GetFrameCount() const
+{
+  return mFrameCount;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistAccumulator::GetChannelCount() const
+{
+  return mChannels;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+double CHistAccumulator::GetTotal(unsigned Channel) const
+{
+  const double* pSum = GetSum(Channel);
+
+  double Total = 0;
+  for (unsigned i = 0; i < mBinCount; ++i)
+  {
+    Total += pSum[i];
+  }
+  return Total;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+double CHistAccumulator::GetMean(unsigned Channel) const
+{
+  const double* pSum = GetSum(Channel);
+
+  double Total = 0;
+  double Weighted = 0;
+  for (unsigned i = 0; i < mBinCount; ++i)
+  {
+    Total += pSum[i];
+    Weighted += i * pSum[i];
+  }
+
+  return (Total > 0) ? (Weighted / Total) : 0;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+double CHistAccumulator::GetStdDev(unsigned Channel) const
+{
+  const double* pSum = GetSum(Channel);
+  const double Mean = GetMean(Channel);
+
+  double Total = 0;
+  double Variance = 0;
+  for (unsigned i = 0; i < mBinCount; ++i)
+  {
+    Total += pSum[i];
+    Variance += pSum[i] * (i - Mean) * (i - Mean);
+  }
+
+  return (Total > 0) ? sqrt(Variance / Total) : 0;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+int CHistAccumulator::GetMinBin(unsigned Channel) const
+{
+  const double* pSum = GetSum(Channel);
+
+  for (unsigned i = 0; i < mBinCount; ++i)
+  {
+    if (pSum[i] > 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+int CHistAccumulator::GetMaxBin(unsigned Channel) const
+{
+  const double* pSum = GetSum(Channel);
+
+  for (int i = (int)mBinCount - 1; i >= 0; --i)
+  {
+    if (pSum[i] > 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+int CHistAccumulator::GetModeBin(unsigned Channel) const
+{
+  const double* pSum = GetSum(Channel);
+
+  int Mode = -1;
+  double ModeCount = 0;
+  for (unsigned i = 0; i < mBinCount; ++i)
+  {
+    if (pSum[i] > ModeCount)
+    {
+      ModeCount = pSum[i];
+      Mode = i;
+    }
+  }
+  return Mode;
+}
@@ -0,0 +1,325 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#include "histAutoLevels.h"
+#include "histKernels.h"
+using namespace cv;
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// Description:
+//   The internal CHistLib copy always counts 256 bins, one per value level
+//-----------------------------------------------------------------------------
+CHistAutoLevels::CHistAutoLevels(const CHistLib& HistLib, double ClipPercent) :
+  mHistLib(HistLib),
+  mClipPercent(2.0),
+  mDecay(0.9),
+  mSmoothing(0.8),
+  mWindow(HistLib)
+{
+  mHistLib.SetBinCount(HIST_LIB_LEVELS);
+  mWindow = CHistAccumulator(mHistLib, HIST_LIB_CHANNELS_VALUE, 0);
+
+  SetClipPercent(ClipPercent);
+  Reset();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistAutoLevels::~CHistAutoLevels()
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::SetClipPercent(double ClipPercent)
+{
+  if ((ClipPercent >= 0) && (ClipPercent < 100))
+  {
+    mClipPercent = ClipPercent;
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::SetWindowSize(unsigned WindowSize)
+{
+  mWindow.SetWindowSize(WindowSize);
+  Reset();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::SetDecay(double Decay)
+{
+  if ((Decay >= 0) && (Decay < 1))
+  {
+    mDecay = Decay;
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::SetSmoothing(double Smoothing)
+{
+  if ((Smoothing >= 0) && (Smoothing < 1))
+  {
+    mSmoothing = Smoothing;
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+double CHistAutoLevels::GetClipPercent() const
+{
+  return mClipPercent;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistAutoLevels::GetWindowSize() const
+{
+  return mWindow.GetWindowSize();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+double CHistAutoLevels::GetDecay() const
+{
+  return mDecay;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+double CHistAutoLevels::GetSmoothing() const
+{
+  return mSmoothing;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::GetClipPoints(double& Low, double& High) const
+{
+  Low = mLow;
+  High = mHigh;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::Reset()
+{
+  mWindow.Reset();
+  mHist.assign(HIST_LIB_LEVELS, 0.0);
+  mHasFrames = false;
+
+  mLow = 0;
+  mHigh = HIST_LIB_LEVELS - 1;
+
+  // Forces the identity tables to be built
+  mTableLow = -1;
+  mTableHigh = -1;
+  UpdateScales();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::Process(const Mat& Frame, Mat& FrameNorm)
+{
+  if ((Frame.type() != CV_8UC3) && (Frame.type() != CV_8UC4))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistAutoLevels::Process");
+  }
+
+  mHistLib.ComputeHistogramValue(Frame, mFrameHist, mWorkspace);
+
+  AddHistogram(mFrameHist);
+  Apply(Frame, FrameNorm);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::Process(
+  const Mat& Frame,
+  Mat& FrameNorm,
+  const MatND& Hist)
+{
+  AddHistogram(Hist);
+  Apply(Frame, FrameNorm);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Adds a frame histogram to the aggregate and moves the smoothed clip
+//   points towards the clip points of the aggregate.  The first frame sets
+//   them directly.
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::AddHistogram(const MatND& Hist)
+{
+  if ((Hist.type() != CV_32F) || (Hist.total() != HIST_LIB_LEVELS))
+  {
+    CV_Error(CV_StsBadArg, "CHistAutoLevels::AddHistogram");
+  }
+
+  if (mWindow.GetWindowSize() > 0)
+  {
+    mWindow.AddHistogram(Hist);
+    mWindow.GetHistogram(mWindowHist);
+
+    for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      mHist[i] = mWindowHist.at<float>(i);
+    }
+  }
+  else
+  {
+    for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      mHist[i] = mDecay * mHist[i] + Hist.at<float>(i);
+    }
+  }
+
+  double Low;
+  double High;
+  FindClipPoints(Low, High);
+
+  if (mHasFrames)
+  {
+    mLow = mSmoothing * mLow + (1 - mSmoothing) * Low;
+    mHigh = mSmoothing * mHigh + (1 - mSmoothing) * High;
+  }
+  else
+  {
+    mLow = Low;
+    mHigh = High;
+    mHasFrames = true;
+  }
+
+  UpdateScales();
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Rescales B, G and R by newV / V so hue and saturation are kept.  Frame
+//   and FrameNorm may be the same image.
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::Apply(const Mat& Frame, Mat& FrameNorm)
+{
+  if ((Frame.type() != CV_8UC3) && (Frame.type() != CV_8UC4))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistAutoLevels::Apply");
+  }
+
+  ApplyValueScales(
+    Frame,
+    FrameNorm,
+    mScales,
+    GetBandCount(Frame, mHistLib.GetThreadCount()));
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Low is the first level at which more than half of the clipped pixels lie
+//   at or below it, High the last level with more than half at or above it
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::FindClipPoints(double& Low, double& High) const
+{
+  double Total = 0;
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Total += mHist[i];
+  }
+
+  const double ClipHalf = mClipPercent / 100.0 * Total / 2;
+  double Sum = 0;
+
+  Low = 0;
+  for (int i = 0; i < HIST_LIB_LEVELS - 1; ++i)
+  {
+    Sum += mHist[i];
+    if (Sum > ClipHalf)
+    {
+      Low = i;
+      break;
+    }
+  }
+
+  Sum = 0;
+  High = HIST_LIB_LEVELS - 1;
+  for (int i = HIST_LIB_LEVELS - 1; i > 0; --i)
+  {
+    Sum += mHist[i];
+    if (Sum > ClipHalf)
+    {
+      High = i;
+      break;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Rebuilds the stretch tables when the rounded clip points change.  A
+//   range that has collapsed (a flat frame) maps every value to itself.
+//-----------------------------------------------------------------------------
+void CHistAutoLevels::UpdateScales()
+{
+  const int Low = cvRound(mLow);
+  const int High = cvRound(mHigh);
+
+  if ((Low == mTableLow) && (High == mTableHigh))
+  {
+    return;
+  }
+
+  mTableLow = Low;
+  mTableHigh = High;
+
+  uchar Stretch[HIST_LIB_LEVELS];
+
+  if ((High > Low) && mHistLib.GetNormalizeFixedPoint())
+  {
+    BuildFixedStretchLut(Low, High - Low, Stretch);
+  }
+  else if (High > Low)
+  {
+    BuildStretchLut(Low, 255.0 / (High - Low), Stretch);
+  }
+  else
+  {
+    for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      Stretch[i] = (uchar)i;
+    }
+  }
+
+  BuildValueScales(Stretch, mScales);
+}
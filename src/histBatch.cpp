@@ -0,0 +1,398 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#include "histBatch.h"
+#include <algorithm>
+#include <thread>
+using namespace cv;
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Per worker state: its own CHistLib, job queue and scratch buffers that
+//   are reused from one image to the next
+//-----------------------------------------------------------------------------
+struct CHistBatch::CWorker
+{
+  CWorker(const CHistLib& Settings) :
+    HistLib(Settings)
+  {
+    // The pool already provides the parallelism
+    HistLib.SetThreadCount(1);
+  }
+
+  CHistLib HistLib;
+  std::thread Thread;
+
+  std::mutex Lock;
+  std::deque<size_t> Jobs;
+
+  // Drawing normalizes histograms in place, so plots are drawn from copies
+  MatND Scratch[3];
+
+  // Draw layers and merged histograms
+  CHistWorkspace Workspace;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistBatch::CHistBatch(
+  const CHistLib& HistLib,
+  EHistChannels Channels,
+  unsigned ThreadCount) :
+  mChannels(Channels),
+  mDrawPlots(false),
+  mGeneration(0),
+  mBusy(0),
+  mStop(false),
+  mpImages(0),
+  mpResults(0),
+  mpSource(0),
+  mSourceDone(false)
+{
+  if (ThreadCount == 0)
+  {
+    ThreadCount = max(1u, thread::hardware_concurrency());
+  }
+
+  for (unsigned i = 0; i < ThreadCount; ++i)
+  {
+    mWorkers.push_back(new CWorker(HistLib));
+  }
+
+  for (unsigned i = 0; i < ThreadCount; ++i)
+  {
+    mWorkers[i]->Thread = thread(&CHistBatch::WorkerLoop, this, i);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistBatch::~CHistBatch()
+{
+  {
+    lock_guard<mutex> Guard(mLock);
+    mStop = true;
+  }
+  mStart.notify_all();
+
+  for (size_t i = 0; i < mWorkers.size(); ++i)
+  {
+    mWorkers[i]->Thread.join();
+    delete mWorkers[i];
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistBatch::SetDrawPlots(bool DrawPlots)
+{
+  mDrawPlots = DrawPlots;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool CHistBatch::GetDrawPlots() const
+{
+  return mDrawPlots;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistBatch::GetThreadCount() const
+{
+  return (unsigned)mWorkers.size();
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Images are sorted by size and dealt round-robin, so every worker starts
+//   with its share of the large images and the small ones fill the gaps
+//-----------------------------------------------------------------------------
+void CHistBatch::Process(
+  const vector<Mat>& Images,
+  vector<CHistBatchResult>& Results)
+{
+  // Jobs left over from a batch that failed must not run against this one
+  ClearJobs();
+
+  Results.assign(Images.size(), CHistBatchResult());
+
+  vector<size_t> Order(Images.size());
+  for (size_t i = 0; i < Order.size(); ++i)
+  {
+    Order[i] = i;
+  }
+
+  stable_sort(
+    Order.begin(),
+    Order.end(),
+    [&Images](size_t a, size_t b)
+    {
+      return Images[a].total() > Images[b].total();
+    });
+
+  for (size_t i = 0; i < Order.size(); ++i)
+  {
+    mWorkers[i % mWorkers.size()]->Jobs.push_back(Order[i]);
+  }
+
+  mpImages = &Images;
+  mpResults = &Results;
+  mpSource = 0;
+
+  RunBatch();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistBatch::Process(
+  const CImageSource& Source,
+  vector<CHistBatchResult>& Results)
+{
+  mpImages = 0;
+  mpResults = 0;
+  mpSource = &Source;
+  mSourceDone = false;
+  mSourceResults.clear();
+
+  RunBatch();
+
+  Results.assign(
+    make_move_iterator(mSourceResults.begin()),
+    make_move_iterator(mSourceResults.end()));
+  mSourceResults.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Wakes the workers, waits until all of them are idle again and rethrows
+//   the first error a worker ran into.  A worker that fails stops taking
+//   jobs, so the queues are drained before rethrowing.
+//-----------------------------------------------------------------------------
+void CHistBatch::RunBatch()
+{
+  unique_lock<mutex> Guard(mLock);
+
+  mError = exception_ptr();
+  mBusy = (unsigned)mWorkers.size();
+  mGeneration++;
+  mStart.notify_all();
+
+  mDone.wait(Guard, [this] { return mBusy == 0; });
+
+  if (mError)
+  {
+    Guard.unlock();
+    ClearJobs();
+    rethrow_exception(mError);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Drops the queued jobs of every worker
+//-----------------------------------------------------------------------------
+void CHistBatch::ClearJobs()
+{
+  for (size_t i = 0; i < mWorkers.size(); ++i)
+  {
+    lock_guard<mutex> Guard(mWorkers[i]->Lock);
+    mWorkers[i]->Jobs.clear();
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistBatch::WorkerLoop(unsigned Id)
+{
+  CWorker& Worker = *mWorkers[Id];
+  unsigned Generation = 0;
+
+  for (;;)
+  {
+    {
+      unique_lock<mutex> Guard(mLock);
+      mStart.wait(
+        Guard,
+        [&] { return mStop || (mGeneration != Generation); });
+
+      if (mStop)
+      {
+        return;
+      }
+      Generation = mGeneration;
+    }
+
+    try
+    {
+      if (mpSource)
+      {
+        Mat Image;
+        CHistBatchResult* pResult;
+
+        while (NextSourceJob(Image, pResult))
+        {
+          RunJob(Worker, Image, *pResult);
+        }
+      }
+      else
+      {
+        size_t Job;
+
+        while (NextJob(Id, Job))
+        {
+          RunJob(Worker, (*mpImages)[Job], (*mpResults)[Job]);
+        }
+      }
+    }
+    catch (...)
+    {
+      lock_guard<mutex> Guard(mLock);
+      if (!mError)
+      {
+        mError = current_exception();
+      }
+    }
+
+    lock_guard<mutex> Guard(mLock);
+    if (--mBusy == 0)
+    {
+      mDone.notify_all();
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Takes the next job from the front of the worker's own queue, or steals
+//   one from the back of another worker's queue
+//-----------------------------------------------------------------------------
+bool CHistBatch::NextJob(unsigned Id, size_t& Job)
+{
+  {
+    CWorker& Own = *mWorkers[Id];
+    lock_guard<mutex> Guard(Own.Lock);
+
+    if (!Own.Jobs.empty())
+    {
+      Job = Own.Jobs.front();
+      Own.Jobs.pop_front();
+      return true;
+    }
+  }
+
+  for (size_t i = 1; i < mWorkers.size(); ++i)
+  {
+    CWorker& Victim = *mWorkers[(Id + i) % mWorkers.size()];
+    lock_guard<mutex> Guard(Victim.Lock);
+
+    if (!Victim.Jobs.empty())
+    {
+      Job = Victim.Jobs.back();
+      Victim.Jobs.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Pulls the next image from the source.  The result slot is appended to a
+//   deque, which keeps references to earlier slots valid.
+//-----------------------------------------------------------------------------
+bool CHistBatch::NextSourceJob(Mat& Image, CHistBatchResult*& pResult)
+{
+  lock_guard<mutex> Guard(mSourceLock);
+
+  if (mSourceDone || !(*mpSource)(Image))
+  {
+    mSourceDone = true;
+    return false;
+  }
+
+  mSourceResults.push_back(CHistBatchResult());
+  pResult = &mSourceResults.back();
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistBatch::RunJob(
+  CWorker& Worker,
+  const Mat& Image,
+  CHistBatchResult& Result)
+{
+  if (mChannels == HIST_LIB_CHANNELS_BGR)
+  {
+    Result.Hists.resize(3);
+    Worker.HistLib.ComputeHistogramBGR(
+      Image,
+      Result.Hists[0],
+      Result.Hists[1],
+      Result.Hists[2],
+      Worker.Workspace);
+
+    if (mDrawPlots)
+    {
+      Result.Hists[0].copyTo(Worker.Scratch[0]);
+      Result.Hists[1].copyTo(Worker.Scratch[1]);
+      Result.Hists[2].copyTo(Worker.Scratch[2]);
+
+      Worker.HistLib.DrawHistogramBGR(
+        Worker.Scratch[0],
+        Worker.Scratch[1],
+        Worker.Scratch[2],
+        Result.Plot,
+        Worker.Workspace);
+    }
+  }
+  else
+  {
+    Result.Hists.resize(1);
+    Worker.HistLib.ComputeHistogramValue(
+      Image,
+      Result.Hists[0],
+      Worker.Workspace);
+
+    if (mDrawPlots)
+    {
+      Result.Hists[0].copyTo(Worker.Scratch[0]);
+      Worker.HistLib.DrawHistogramValue(
+        Worker.Scratch[0],
+        Result.Plot,
+        Worker.Workspace);
+    }
+  }
+}
@@ -0,0 +1,290 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#include "histCumulative.h"
+#include <algorithm>
+#include <cmath>
+using namespace cv;
+using namespace std;
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CCumulativeHist::CCumulativeHist()
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CCumulativeHist::CCumulativeHist(const unsigned* Counts, unsigned BinCount)
+{
+  SetCounts(Counts, BinCount);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CCumulativeHist::CCumulativeHist(const MatND& Hist)
+{
+  SetHistogram(Hist);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CCumulativeHist::~CCumulativeHist()
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CCumulativeHist::SetCounts(const unsigned* Counts, unsigned BinCount)
+{
+  mCounts.assign(Counts, Counts + BinCount);
+  Update();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CCumulativeHist::SetCounts(const vector<uint64>& Counts)
+{
+  mCounts = Counts;
+  Update();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CCumulativeHist::SetHistogram(const MatND& Hist)
+{
+  if ((Hist.type() != CV_32F) || !Hist.isContinuous())
+  {
+    CV_Error(CV_StsBadArg, "CCumulativeHist::SetHistogram");
+  }
+
+  const float* pHist = Hist.ptr<float>();
+  const size_t BinCount = Hist.total();
+
+  mCounts.resize(BinCount);
+  for (size_t i = 0; i < BinCount; ++i)
+  {
+    if (pHist[i] < 0)
+    {
+      CV_Error(CV_StsBadArg, "CCumulativeHist::SetHistogram");
+    }
+
+    mCounts[i] = (uint64)(pHist[i] + 0.5);
+  }
+
+  Update();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CCumulativeHist::GetBinCount() const
+{
+  return (unsigned)mCounts.size();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+uint64 CCumulativeHist::GetTotal() const
+{
+  return mCumulative.empty() ? 0 : mCumulative.back();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+uint64 CCumulativeHist::GetCount(unsigned Bin) const
+{
+  CV_Assert(Bin < mCounts.size());
+
+  return mCounts[Bin];
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+uint64 CCumulativeHist::GetCumulative(unsigned Bin) const
+{
+  CV_Assert(Bin < mCumulative.size());
+
+  return mCumulative[Bin];
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CCumulativeHist::FindFirstAbove(uint64 Count) const
+{
+  return (unsigned)(
+    upper_bound(mCumulative.begin(), mCumulative.end(), Count) -
+    mCumulative.begin());
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CCumulativeHist::FindFirstAtLeast(uint64 Count) const
+{
+  return (unsigned)(
+    lower_bound(mCumulative.begin(), mCumulative.end(), Count) -
+    mCumulative.begin());
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Nearest rank definition: the bin that holds sample ceil(Fraction * Total)
+//   (counting from 1) of the sorted samples
+//-----------------------------------------------------------------------------
+unsigned CCumulativeHist::Quantile(double Fraction) const
+{
+  const uint64 Total = GetTotal();
+
+  if (Total == 0)
+  {
+    return 0;
+  }
+
+  Fraction = std::min(std::max(Fraction, 0.0), 1.0);
+
+  uint64 Rank = (uint64)ceil(Fraction * (double)Total);
+  Rank = std::min(std::max(Rank, (uint64)1), Total);
+
+  return FindFirstAtLeast(Rank);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CCumulativeHist::Quantiles(
+  const double* Fractions,
+  size_t Count,
+  unsigned* pBins) const
+{
+  for (size_t i = 0; i < Count; ++i)
+  {
+    pBins[i] = Quantile(Fractions[i]);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CCumulativeHist::Quantiles(
+  const vector<double>& Fractions,
+  vector<unsigned>& Bins) const
+{
+  Bins.resize(Fractions.size());
+
+  if (!Fractions.empty())
+  {
+    Quantiles(&Fractions[0], Fractions.size(), &Bins[0]);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+double CCumulativeHist::Rank(unsigned Bin) const
+{
+  const uint64 Total = GetTotal();
+
+  if ((Total == 0) || mCumulative.empty())
+  {
+    return 0;
+  }
+
+  Bin = std::min(Bin, (unsigned)mCumulative.size() - 1);
+
+  return (double)mCumulative[Bin] / (double)Total;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Gives exactly the bounds of the linear scans NormalizeClipImageBGR used
+//   to do.  Low is the first bin in [1, last) whose cumulative count exceeds
+//   ClipCount.  The upper scan started with the last bin already counted and
+//   then added the bins from the last one down to bin 2, so High is the
+//   highest bin >= 2 whose count from the top exceeds ClipCount minus the
+//   last bin.
+//-----------------------------------------------------------------------------
+void CCumulativeHist::FindClipPoints(
+  uint64 ClipCount,
+  unsigned& Low,
+  unsigned& High) const
+{
+  Low = 0;
+  High = 0;
+
+  if (mCounts.empty())
+  {
+    return;
+  }
+
+  const unsigned Last = GetBinCount() - 1;
+  const uint64 Total = GetTotal();
+
+  High = Last;
+
+  if (mCounts[0] < ClipCount)
+  {
+    const unsigned Bin = FindFirstAbove(ClipCount);
+
+    if (Bin < Last)
+    {
+      Low = Bin;
+    }
+  }
+
+  if (mCounts[Last] < ClipCount)
+  {
+    const uint64 Remaining = ClipCount - mCounts[Last];
+
+    if (Remaining < Total)
+    {
+      // Count from the top at Bin is Total - Cumulative(Bin - 1)
+      const unsigned Bin = FindFirstAtLeast(Total - Remaining);
+
+      if (Bin >= 2)
+      {
+        High = Bin;
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Rebuilds the prefix sums
+//-----------------------------------------------------------------------------
+void CCumulativeHist::Update()
+{
+  mCumulative.resize(mCounts.size());
+
+  uint64 Sum = 0;
+  for (size_t i = 0; i < mCounts.size(); ++i)
+  {
+    Sum += mCounts[i];
+    mCumulative[i] = Sum;
+  }
+}
@@ -0,0 +1,271 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#include "histIntegral.h"
+#include "histKernels.h"
+#include <algorithm>
+using namespace cv;
+using namespace std;
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistIntegral::CHistIntegral(
+  const CHistLib& HistLib,
+  EHistChannels Channels,
+  unsigned CellSize) :
+  mBinCount(HistLib.GetBinCount()),
+  mChannels(Channels),
+  mCellSize(max(1u, CellSize)),
+  mGridRows(0),
+  mGridCols(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistIntegral::~CHistIntegral()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Builds the table one row of cells at a time.  The cells of the current
+//   row are counted first, then a running sum along the row is added to the
+//   entries of the previous row of cell boundaries.
+//-----------------------------------------------------------------------------
+void CHistIntegral::Build(const Mat& Image)
+{
+  switch (Image.type())
+  {
+    case CV_8UC1:
+    case CV_8UC3:
+    case CV_8UC4:
+    break;
+
+    default:
+      CV_Error(CV_StsUnsupportedFormat, "CHistIntegral::Build");
+    break;
+  }
+
+  if ((mChannels == HIST_LIB_CHANNELS_BGR) && (Image.channels() == 1))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistIntegral::Build");
+  }
+
+  const int Cell = (int)mCellSize;
+  const int CellRows = (Image.rows + Cell - 1) / Cell;
+  const int CellCols = (Image.cols + Cell - 1) / Cell;
+  const size_t EntrySize = mChannels * mBinCount;
+
+  mImageSize = Image.size();
+  mGridRows = CellRows + 1;
+  mGridCols = CellCols + 1;
+  mTable.assign((size_t)mGridRows * mGridCols * EntrySize, 0);
+
+  // Same level to bin mapping as FoldHistogram
+  unsigned short BinOf[HIST_LIB_LEVELS];
+  for (unsigned i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    BinOf[i] = (unsigned short)((i * mBinCount) >> 8);
+  }
+
+  const int Channels = Image.channels();
+  vector<unsigned> RowCells((size_t)CellCols * EntrySize);
+  vector<uchar> Value(Image.cols);
+
+  for (int cy = 0; cy < CellRows; ++cy)
+  {
+    fill(RowCells.begin(), RowCells.end(), 0u);
+
+    const int yEnd = min(Image.rows, (cy + 1) * Cell);
+    for (int y = cy * Cell; y < yEnd; ++y)
+    {
+      const uchar* pRow = Image.ptr(y);
+
+      if (mChannels == HIST_LIB_CHANNELS_BGR)
+      {
+        for (int x = 0; x < Image.cols; ++x, pRow += Channels)
+        {
+          unsigned* pCell = &RowCells[(x / Cell) * EntrySize];
+          pCell[BinOf[pRow[0]]]++;
+          pCell[mBinCount + BinOf[pRow[1]]]++;
+          pCell[2 * mBinCount + BinOf[pRow[2]]]++;
+        }
+      }
+      else
+      {
+        if (Channels != 1)
+        {
+          ComputeValuePixels(pRow, &Value[0], Image.cols, Channels);
+          pRow = &Value[0];
+        }
+
+        for (int x = 0; x < Image.cols; ++x)
+        {
+          RowCells[(x / Cell) * EntrySize + BinOf[pRow[x]]]++;
+        }
+      }
+    }
+
+    // Entry (cy + 1, cx + 1) = entry (cy, cx + 1) + cells 0..cx of this row
+    const unsigned* pAbove = &mTable[(size_t)cy * mGridCols * EntrySize];
+    unsigned* pEntry = &mTable[(size_t)(cy + 1) * mGridCols * EntrySize];
+
+    vector<unsigned> Run(EntrySize, 0);
+    for (int cx = 0; cx < CellCols; ++cx)
+    {
+      const unsigned* pCell = &RowCells[cx * EntrySize];
+      const unsigned* pUp = pAbove + (cx + 1) * EntrySize;
+      unsigned* pOut = pEntry + (cx + 1) * EntrySize;
+
+      for (size_t i = 0; i < EntrySize; ++i)
+      {
+        Run[i] += pCell[i];
+        pOut[i] = pUp[i] + Run[i];
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistIntegral::Query(const Rect& Region, MatND& Hist) const
+{
+  if (mChannels != HIST_LIB_CHANNELS_VALUE)
+  {
+    CV_Error(CV_StsBadArg, "CHistIntegral::Query");
+  }
+
+  QueryChannel(Region, 0, Hist);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistIntegral::Query(
+  const Rect& Region,
+  MatND& HistB,
+  MatND& HistG,
+  MatND& HistR) const
+{
+  if (mChannels != HIST_LIB_CHANNELS_BGR)
+  {
+    CV_Error(CV_StsBadArg, "CHistIntegral::Query");
+  }
+
+  QueryChannel(Region, 0, HistB);
+  QueryChannel(Region, 1, HistG);
+  QueryChannel(Region, 2, HistR);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Histogram of a rectangle from the four corner entries:
+//   bottom-right - top-right - bottom-left + top-left.  Unsigned arithmetic
+//   wraps, so the intermediate differences are harmless.
+//-----------------------------------------------------------------------------
+void CHistIntegral::QueryChannel(
+  const Rect& Region,
+  unsigned Channel,
+  MatND& Hist) const
+{
+  if (mTable.empty())
+  {
+    CV_Error(CV_StsError, "CHistIntegral::Query");
+  }
+
+  const int x0 = SnapToCell(Region.x, mGridCols);
+  const int y0 = SnapToCell(Region.y, mGridRows);
+  const int x1 = max(x0, SnapToCell(Region.x + Region.width, mGridCols));
+  const int y1 = max(y0, SnapToCell(Region.y + Region.height, mGridRows));
+
+  const unsigned Offset = Channel * mBinCount;
+  const unsigned* pA = GetEntry(y0, x0) + Offset;
+  const unsigned* pB = GetEntry(y0, x1) + Offset;
+  const unsigned* pC = GetEntry(y1, x0) + Offset;
+  const unsigned* pD = GetEntry(y1, x1) + Offset;
+
+  Hist.create(mBinCount, 1, CV_32F);
+  float* pHist = Hist.ptr<float>();
+
+  for (unsigned i = 0; i < mBinCount; ++i)
+  {
+    pHist[i] = (float)(pD[i] - pB[i] - pC[i] + pA[i]);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+const unsigned* CHistIntegral::GetEntry(int CellY, int CellX) const
+{
+  return &mTable[((size_t)CellY * mGridCols + CellX) * mChannels * mBinCount];
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Converts a pixel coordinate to the nearest cell boundary, clamped to the
+//   image
+//-----------------------------------------------------------------------------
+int CHistIntegral::SnapToCell(int Coordinate, int GridSize) const
+{
+  const int Cell = (int)mCellSize;
+  const int Snapped = (max(0, Coordinate) + Cell / 2) / Cell;
+
+  return min(Snapped, GridSize - 1);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+Size CHistIntegral::GetImageSize() const
+{
+  return mImageSize;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistIntegral::GetBinCount() const
+{
+  return mBinCount;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistIntegral::GetCellSize() const
+{
+  return mCellSize;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+size_t CHistIntegral::GetMemorySize() const
+{
+  return mTable.size() * sizeof(unsigned);
+}
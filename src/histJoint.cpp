@@ -0,0 +1,431 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#include "histJoint.h"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+using namespace cv;
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts cells directly in a table with one entry per cell
+//-----------------------------------------------------------------------------
+class CDenseCells
+{
+  public:
+    CDenseCells(size_t Cells) :
+      mCounts(Cells, 0)
+    {
+    }
+
+    void Add(unsigned Key)
+    {
+      mCounts[Key]++;
+    }
+
+    // Appends the non-empty cells in key order
+    void Extract(vector<unsigned>& Keys, vector<unsigned>& Counts) const
+    {
+      for (size_t Key = 0; Key < mCounts.size(); ++Key)
+      {
+        if (mCounts[Key])
+        {
+          Keys.push_back((unsigned)Key);
+          Counts.push_back(mCounts[Key]);
+        }
+      }
+    }
+
+  private:
+    vector<unsigned> mCounts;
+};
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts cells in an open addressing (linear probing) hash table, so memory
+//   follows the number of occupied cells and every pixel costs one hash and
+//   usually one probe.  An entry with a zero count is empty.  The table
+//   doubles when it gets half full.
+//-----------------------------------------------------------------------------
+class CSparseCells
+{
+  public:
+    CSparseCells() :
+      mBits(0),
+      mSize(0)
+    {
+      Resize(12);
+    }
+
+    void Add(unsigned Key)
+    {
+      size_t i = Slot(Key);
+
+      for (;;)
+      {
+        if (!mCounts[i])
+        {
+          mKeys[i] = Key;
+          mCounts[i] = 1;
+
+          if (++mSize * 2 > mKeys.size())
+          {
+            Resize(mBits + 1);
+          }
+          return;
+        }
+
+        if (mKeys[i] == Key)
+        {
+          mCounts[i]++;
+          return;
+        }
+
+        i = (i + 1) & (mKeys.size() - 1);
+      }
+    }
+
+    // Appends the non-empty cells in key order
+    void Extract(vector<unsigned>& Keys, vector<unsigned>& Counts) const
+    {
+      // Key in the high half so sorting orders by key
+      vector<uint64> Cells;
+      Cells.reserve(mSize);
+
+      for (size_t i = 0; i < mKeys.size(); ++i)
+      {
+        if (mCounts[i])
+        {
+          Cells.push_back(((uint64)mKeys[i] << 32) | mCounts[i]);
+        }
+      }
+
+      sort(Cells.begin(), Cells.end());
+
+      Keys.reserve(Keys.size() + Cells.size());
+      Counts.reserve(Counts.size() + Cells.size());
+
+      for (size_t i = 0; i < Cells.size(); ++i)
+      {
+        Keys.push_back((unsigned)(Cells[i] >> 32));
+        Counts.push_back((unsigned)Cells[i]);
+      }
+    }
+
+  private:
+    // Fibonacci hashing, the top bits of the product pick the slot
+    size_t Slot(unsigned Key) const
+    {
+      return (size_t)((Key * 2654435769u) >> (32 - mBits));
+    }
+
+    void Resize(unsigned Bits)
+    {
+      vector<unsigned> Keys(size_t(1) << Bits);
+      vector<unsigned> Counts(size_t(1) << Bits, 0);
+
+      mKeys.swap(Keys);
+      mCounts.swap(Counts);
+      mBits = Bits;
+
+      for (size_t i = 0; i < Keys.size(); ++i)
+      {
+        if (Counts[i])
+        {
+          size_t j = Slot(Keys[i]);
+          while (mCounts[j])
+          {
+            j = (j + 1) & (mKeys.size() - 1);
+          }
+
+          mKeys[j] = Keys[i];
+          mCounts[j] = Counts[i];
+        }
+      }
+    }
+
+    unsigned mBits;
+    size_t mSize;
+    vector<unsigned> mKeys;
+    vector<unsigned> mCounts;
+};
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts every pixel of the image into Cells.  The axis count and the
+//   counter are template parameters, so the per pixel loop has no branches.
+//   HS and ab are converted a row at a time into a reusable row buffer, so
+//   no converted copy of the image is made.
+//-----------------------------------------------------------------------------
+template <int Dims, typename TCells>
+static void CountCells(
+  const Mat& Image,
+  EHistJointSpace Space,
+  const uchar* Quantize,
+  unsigned Levels,
+  TCells& Cells)
+{
+  Mat Converted;
+  const int Channels = Image.channels();
+
+  for (int y = 0; y < Image.rows; ++y)
+  {
+    const uchar* p = Image.ptr(y);
+    int Step = Channels;
+
+    if (Space == HIST_LIB_JOINT_HS)
+    {
+      cvtColor(Image.row(y), Converted, CV_BGR2HSV_FULL);
+      p = Converted.ptr();
+      Step = 3;
+    }
+    else if (Space == HIST_LIB_JOINT_AB)
+    {
+      // a and b are channels 1 and 2 of L*a*b*
+      cvtColor(Image.row(y), Converted, CV_BGR2Lab);
+      p = Converted.ptr() + 1;
+      Step = 3;
+    }
+
+    for (int x = 0; x < Image.cols; ++x, p += Step)
+    {
+      unsigned Key = Quantize[p[0]] * Levels + Quantize[p[1]];
+      if (Dims == 3)
+      {
+        Key = Key * Levels + Quantize[p[2]];
+      }
+
+      Cells.Add(Key);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistJoint::CHistJoint() :
+  mSpace(HIST_LIB_JOINT_BGR),
+  mLevels(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistJoint::~CHistJoint()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts every pixel once.  Small histograms are counted densely and
+//   compacted, large ones go through a hash table of the occupied cells that
+//   is sorted once at the end.
+//-----------------------------------------------------------------------------
+void CHistJoint::Compute(
+  const Mat& Image,
+  EHistJointSpace Space,
+  unsigned Levels)
+{
+  if ((Image.type() != CV_8UC3) && (Image.type() != CV_8UC4))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistJoint::Compute");
+  }
+
+  if ((Levels < 2) || (Levels > 256))
+  {
+    CV_Error(CV_StsOutOfRange, "CHistJoint::Compute");
+  }
+
+  mSpace = Space;
+  mLevels = Levels;
+  mKeys.clear();
+  mCounts.clear();
+
+  const int Dims = GetDims();
+  const size_t Cells = (Dims == 3)
+    ? (size_t)Levels * Levels * Levels
+    : (size_t)Levels * Levels;
+  const bool IsDense = (Cells <= HIST_LIB_JOINT_DENSE_CELLS);
+
+  // Quantization of an 8-bit level, same mapping as the 1D histograms
+  uchar Quantize[256];
+  for (unsigned i = 0; i < 256; ++i)
+  {
+    Quantize[i] = (uchar)((i * Levels) >> 8);
+  }
+
+  if (IsDense)
+  {
+    CDenseCells Dense(Cells);
+
+    if (Dims == 3)
+    {
+      CountCells<3>(Image, Space, Quantize, Levels, Dense);
+    }
+    else
+    {
+      CountCells<2>(Image, Space, Quantize, Levels, Dense);
+    }
+
+    Dense.Extract(mKeys, mCounts);
+  }
+  else
+  {
+    CSparseCells Sparse;
+
+    if (Dims == 3)
+    {
+      CountCells<3>(Image, Space, Quantize, Levels, Sparse);
+    }
+    else
+    {
+      CountCells<2>(Image, Space, Quantize, Levels, Sparse);
+    }
+
+    Sparse.Extract(mKeys, mCounts);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+EHistJointSpace CHistJoint::GetSpace() const
+{
+  return mSpace;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistJoint::GetLevels() const
+{
+  return mLevels;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+int CHistJoint::GetDims() const
+{
+  return (mSpace == HIST_LIB_JOINT_BGR) ? 3 : 2;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+size_t CHistJoint::GetNonZeroCount() const
+{
+  return mKeys.size();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+const vector<unsigned>& CHistJoint::GetKeys() const
+{
+  return mKeys;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+const vector<unsigned>& CHistJoint::GetCounts() const
+{
+  return mCounts;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistJoint::MakeKey(const int* Index) const
+{
+  unsigned Key = 0;
+  for (int d = 0; d < GetDims(); ++d)
+  {
+    Key = Key * mLevels + Index[d];
+  }
+  return Key;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Binary search over the sorted keys
+//-----------------------------------------------------------------------------
+unsigned CHistJoint::GetCount(const int* Index) const
+{
+  const unsigned Key = MakeKey(Index);
+  vector<unsigned>::const_iterator it =
+    lower_bound(mKeys.begin(), mKeys.end(), Key);
+
+  if ((it == mKeys.end()) || (*it != Key))
+  {
+    return 0;
+  }
+  return mCounts[it - mKeys.begin()];
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistJoint::ToSparseMat(SparseMat& Hist) const
+{
+  const int Dims = GetDims();
+  const int Sizes[] = {(int)mLevels, (int)mLevels, (int)mLevels};
+
+  Hist.create(Dims, Sizes, CV_32F);
+  Hist.clear();
+
+  for (size_t i = 0; i < mKeys.size(); ++i)
+  {
+    int Index[3];
+    unsigned Key = mKeys[i];
+
+    for (int d = Dims - 1; d >= 0; --d)
+    {
+      Index[d] = Key % mLevels;
+      Key /= mLevels;
+    }
+
+    Hist.ref<float>(Index) = (float)mCounts[i];
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   The key of a cell is its row-major offset in the dense histogram
+//-----------------------------------------------------------------------------
+void CHistJoint::ToDense(MatND& Hist) const
+{
+  const int Dims = GetDims();
+  const int Sizes[] = {(int)mLevels, (int)mLevels, (int)mLevels};
+
+  Hist.create(Dims, Sizes, CV_32F);
+  Hist.setTo(Scalar(0));
+
+  float* pHist = Hist.ptr<float>();
+  for (size_t i = 0; i < mKeys.size(); ++i)
+  {
+    pHist[mKeys[i]] = (float)mCounts[i];
+  }
+}
@@ -0,0 +1,2642 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#include "histKernels.h"
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cstring>
+using namespace cv;
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistWorkspace::CHistWorkspace() :
+  mpBuffers(new CBuffers)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistWorkspace::~CHistWorkspace()
+{
+  delete mpBuffers;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistWorkspace::Release()
+{
+  delete mpBuffers;
+  mpBuffers = new CBuffers;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CBGRCounter::CBGRCounter()
+{
+  Clear();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CBGRCounter::Clear()
+{
+  memset(mCounts, 0, sizeof(mCounts));
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts a horizontal band of the image.  Continuous images are treated as
+//   one long row so the inner loop is not restarted at every row boundary.
+//-----------------------------------------------------------------------------
+void CBGRCounter::AddRows(const Mat& Image, int RowBegin, int RowEnd)
+{
+  const int Channels = Image.channels();
+
+  if (Image.isContinuous())
+  {
+    AddPixels(
+      Image.ptr(RowBegin),
+      (size_t)(RowEnd - RowBegin) * Image.cols,
+      Channels);
+    return;
+  }
+
+  for (int y = RowBegin; y < RowEnd; ++y)
+  {
+    AddPixels(Image.ptr(y), Image.cols, Channels);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Reads every pixel once and updates all three channel histograms.  Four
+//   consecutive pixels go to four different sub-histograms.
+//-----------------------------------------------------------------------------
+void CBGRCounter::AddPixels(const uchar* p, size_t Width, int Channels)
+{
+  unsigned (*B)[HIST_LIB_LEVELS] = mCounts[0];
+  unsigned (*G)[HIST_LIB_LEVELS] = mCounts[1];
+  unsigned (*R)[HIST_LIB_LEVELS] = mCounts[2];
+
+  const int C = Channels;
+  size_t x = 0;
+
+  for (; x + 4 <= Width; x += 4, p += 4 * C)
+  {
+    B[0][p[0]]++;       G[0][p[1]]++;       R[0][p[2]]++;
+    B[1][p[C]]++;       G[1][p[C+1]]++;     R[1][p[C+2]]++;
+    B[2][p[2*C]]++;     G[2][p[2*C+1]]++;   R[2][p[2*C+2]]++;
+    B[3][p[3*C]]++;     G[3][p[3*C+1]]++;   R[3][p[3*C+2]]++;
+  }
+
+  for (; x < Width; ++x, p += C)
+  {
+    B[0][p[0]]++;
+    G[0][p[1]]++;
+    R[0][p[2]]++;
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CBGRCounter::Reduce(
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR) const
+{
+  unsigned* Out[3] = {CountsB, CountsG, CountsR};
+
+  for (int c = 0; c < 3; ++c)
+  {
+    for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      unsigned Sum = 0;
+      for (int s = 0; s < HIST_LIB_SUB_HISTS; ++s)
+      {
+        Sum += mCounts[c][s][i];
+      }
+      Out[c][i] += Sum;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CValueCounter::CValueCounter()
+{
+  Clear();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CValueCounter::Clear()
+{
+  memset(mCounts, 0, sizeof(mCounts));
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CValueCounter::AddRows(const Mat& Image, int RowBegin, int RowEnd)
+{
+  const int Channels = Image.channels();
+
+  int Rows = RowEnd - RowBegin;
+  size_t Width = Image.cols;
+
+  if (Image.isContinuous())
+  {
+    Width *= Rows;
+    Rows = 1;
+  }
+
+  for (int y = RowBegin; y < RowBegin + Rows; ++y)
+  {
+    if (Channels == 1)
+    {
+      AddPixels(Image.ptr(y), Width);
+    }
+    else
+    {
+      AddValuePixels(Image.ptr(y), Width, Channels);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CValueCounter::AddPixels(const uchar* p, size_t Width)
+{
+  size_t x = 0;
+
+  for (; x + 4 <= Width; x += 4, p += 4)
+  {
+    mCounts[0][p[0]]++;
+    mCounts[1][p[1]]++;
+    mCounts[2][p[2]]++;
+    mCounts[3][p[3]]++;
+  }
+
+  for (; x < Width; ++x, ++p)
+  {
+    mCounts[0][p[0]]++;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   The value channel is produced a chunk at a time into a small stack buffer
+//   and counted straight away, so no full size temporary image is needed
+//-----------------------------------------------------------------------------
+void CValueCounter::AddValuePixels(
+  const uchar* p,
+  size_t Width,
+  int Channels)
+{
+  uchar Value[HIST_LIB_VALUE_CHUNK];
+
+  for (size_t x = 0; x < Width; x += HIST_LIB_VALUE_CHUNK)
+  {
+    const size_t Count = std::min((size_t)HIST_LIB_VALUE_CHUNK, Width - x);
+
+    ComputeValuePixels(p + x * Channels, Value, Count, Channels);
+    AddPixels(Value, Count);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CValueCounter::AddPixels(const uchar* p, size_t Width, int Channels)
+{
+  if (Channels == 1)
+  {
+    AddPixels(p, Width);
+  }
+  else
+  {
+    AddValuePixels(p, Width, Channels);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CValueCounter::Reduce(unsigned* Counts) const
+{
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    unsigned Sum = 0;
+    for (int s = 0; s < HIST_LIB_SUB_HISTS; ++s)
+    {
+      Sum += mCounts[s][i];
+    }
+    Counts[i] += Sum;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   The HSV value of an 8-bit BGR pixel is max(B, G, R), which is exactly what
+//   cvtColor(CV_BGR2HSV) stores in its third channel
+//-----------------------------------------------------------------------------
+void ComputeValuePixels(
+  const uchar* p,
+  uchar* pValue,
+  size_t Width,
+  int Channels)
+{
+  size_t x = 0;
+
+#if CV_SIMD128
+  const size_t Lanes = v_uint8x16::nlanes;
+
+  if (Channels == 3)
+  {
+    for (; x + Lanes <= Width; x += Lanes)
+    {
+      v_uint8x16 B, G, R;
+      v_load_deinterleave(p + 3 * x, B, G, R);
+      v_store(pValue + x, v_max(B, v_max(G, R)));
+    }
+  }
+  else if (Channels == 4)
+  {
+    for (; x + Lanes <= Width; x += Lanes)
+    {
+      v_uint8x16 B, G, R, A;
+      v_load_deinterleave(p + 4 * x, B, G, R, A);
+      v_store(pValue + x, v_max(B, v_max(G, R)));
+    }
+  }
+#endif
+
+  for (; x < Width; ++x)
+  {
+    const uchar* pPixel = p + x * Channels;
+    pValue[x] = std::max(pPixel[0], std::max(pPixel[1], pPixel[2]));
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+static inline int CountTrailingZeros(uint64 Word)
+{
+#if defined(__GNUC__)
+  return __builtin_ctzll(Word);
+#else
+  int Count = 0;
+  while (!(Word & 1))
+  {
+    Word >>= 1;
+    Count++;
+  }
+  return Count;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts the pixels of one row whose mask bit is set.  Empty words are
+//   skipped, full words are counted with the dense kernel and the remaining
+//   words are split into runs of set bits.  The padding bits of the last word
+//   are masked off, so a mask can never make the kernel read past the row.
+//-----------------------------------------------------------------------------
+template <class TCounter>
+static void AddMaskedRow(
+  TCounter& Counter,
+  const uchar* pRow,
+  const uint64* pWords,
+  int Width,
+  int Channels)
+{
+  const int WordCount =
+    (Width + HIST_LIB_MASK_WORD_BITS - 1) / HIST_LIB_MASK_WORD_BITS;
+  const int LastBits = Width % HIST_LIB_MASK_WORD_BITS;
+
+  for (int w = 0; w < WordCount; ++w)
+  {
+    uint64 Word = pWords[w];
+    const int Base = w * HIST_LIB_MASK_WORD_BITS;
+
+    if ((w == WordCount - 1) && LastBits)
+    {
+      Word &= ((uint64)1 << LastBits) - 1;
+    }
+
+    if (Word == 0)
+    {
+      continue;
+    }
+
+    if (Word == ~(uint64)0)
+    {
+      Counter.AddPixels(
+        pRow + Base * Channels,
+        HIST_LIB_MASK_WORD_BITS,
+        Channels);
+      continue;
+    }
+
+    while (Word)
+    {
+      const int Start = CountTrailingZeros(Word);
+      const uint64 Rest = ~(Word >> Start);
+      const int Run =
+        Rest ? CountTrailingZeros(Rest) : (HIST_LIB_MASK_WORD_BITS - Start);
+
+      Counter.AddPixels(pRow + (Base + Start) * Channels, Run, Channels);
+
+      // Clear the run that was just counted
+      if (Start + Run >= HIST_LIB_MASK_WORD_BITS)
+      {
+        Word = 0;
+      }
+      else
+      {
+        Word &= ~(((uint64)1 << (Start + Run)) - 1);
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Parallel body that counts the masked pixels of one row band per stripe.
+//   8-bit masks are packed a row at a time so both mask kinds share the same
+//   word based kernel.
+//-----------------------------------------------------------------------------
+template <class TCounter>
+class CMaskedBandCountBody : public ParallelLoopBody
+{
+  public:
+    CMaskedBandCountBody(
+      const Mat& Image,
+      const Mat* pMask,
+      const CHistPackedMask* pPackedMask,
+      std::vector<TCounter>& Counters) :
+      mImage(Image),
+      mpMask(pMask),
+      mpPackedMask(pPackedMask),
+      mCounters(Counters)
+    {
+    }
+
+    virtual void operator()(const Range& Bands) const
+    {
+      const int BandCount = (int)mCounters.size();
+      const int Channels = mImage.channels();
+
+      std::vector<uint64> Words(
+        (mImage.cols + HIST_LIB_MASK_WORD_BITS - 1) / HIST_LIB_MASK_WORD_BITS);
+
+      for (int b = Bands.start; b < Bands.end; ++b)
+      {
+        const int yBegin = GetBandStart(mImage.rows, BandCount, b);
+        const int yEnd = GetBandStart(mImage.rows, BandCount, b + 1);
+
+        for (int y = yBegin; y < yEnd; ++y)
+        {
+          const uint64* pWords;
+
+          if (mpPackedMask)
+          {
+            pWords = mpPackedMask->GetRow(y);
+          }
+          else
+          {
+            PackMaskRow(mpMask->ptr(y), mImage.cols, &Words[0]);
+            pWords = &Words[0];
+          }
+
+          AddMaskedRow(
+            mCounters[b],
+            mImage.ptr(y),
+            pWords,
+            mImage.cols,
+            Channels);
+        }
+      }
+    }
+
+  private:
+    const Mat& mImage;
+    const Mat* mpMask;
+    const CHistPackedMask* mpPackedMask;
+    std::vector<TCounter>& mCounters;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+static void CheckMask(
+  const Mat& Image,
+  const Mat* pMask,
+  const CHistPackedMask* pPackedMask)
+{
+  if (pPackedMask)
+  {
+    if (pPackedMask->GetSize() != Image.size())
+    {
+      CV_Error(CV_StsUnmatchedSizes, "CheckMask");
+    }
+  }
+  else if ((pMask == 0) || (pMask->type() != CV_8UC1) ||
+           (pMask->size() != Image.size()))
+  {
+    CV_Error(CV_StsBadArg, "CheckMask");
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountBGRMasked(
+  const Mat& Image,
+  const Mat* pMask,
+  const CHistPackedMask* pPackedMask,
+  int BandCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR)
+{
+  CheckMask(Image, pMask, pPackedMask);
+
+  BandCount = std::max(1, BandCount);
+  std::vector<CBGRCounter> Counters(BandCount);
+  CMaskedBandCountBody<CBGRCounter> Body(Image, pMask, pPackedMask, Counters);
+
+  if (BandCount == 1)
+  {
+    Body(Range(0, 1));
+  }
+  else
+  {
+    parallel_for_(Range(0, BandCount), Body, BandCount);
+  }
+
+  for (int b = 0; b < BandCount; ++b)
+  {
+    Counters[b].Reduce(CountsB, CountsG, CountsR);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountValueMasked(
+  const Mat& Image,
+  const Mat* pMask,
+  const CHistPackedMask* pPackedMask,
+  int BandCount,
+  unsigned* Counts)
+{
+  CheckMask(Image, pMask, pPackedMask);
+
+  BandCount = std::max(1, BandCount);
+  std::vector<CValueCounter> Counters(BandCount);
+  CMaskedBandCountBody<CValueCounter> Body(
+    Image,
+    pMask,
+    pPackedMask,
+    Counters);
+
+  if (BandCount == 1)
+  {
+    Body(Range(0, 1));
+  }
+  else
+  {
+    parallel_for_(Range(0, BandCount), Body, BandCount);
+  }
+
+  for (int b = 0; b < BandCount; ++b)
+  {
+    Counters[b].Reduce(Counts);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Returns the number of pixels skipped before the next random sample.  The
+//   gap is clamped to Limit, so the huge gaps of tiny fractions never reach
+//   an out of range conversion.  Fraction 1 gives a LogKeep of -inf and a
+//   gap of 0.
+//-----------------------------------------------------------------------------
+static size_t GetSampleGap(RNG& Rng, double LogKeep, size_t Limit)
+{
+  const double Gap = log1p(-Rng.uniform(0.0, 1.0)) / LogKeep;
+
+  return (Gap < (double)Limit) ? (size_t)std::max(Gap, 0.0) : Limit;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Gathers the sampled pixels of each row into a contiguous buffer and hands
+//   them to Visitor, so the regular counting kernels can be reused as is.
+//   The lattice uses a whole row step and a fractional column step chosen so
+//   that their product is 1 / Fraction, which keeps the sampled share close
+//   to Fraction for any value (a single square step can only give 1, 1/4,
+//   1/9, ... of the pixels).
+//-----------------------------------------------------------------------------
+template <class TVisitor>
+static size_t VisitSamples(
+  const Mat& Image,
+  bool Random,
+  double Fraction,
+  unsigned Seed,
+  TVisitor& Visitor)
+{
+  if (Image.empty() || !(Fraction > 0))
+  {
+    return 0;
+  }
+
+  Fraction = std::min(Fraction, 1.0);
+
+  const int Channels = Image.channels();
+  std::vector<uchar> Buffer((size_t)Image.cols * Channels);
+  size_t Sampled = 0;
+
+  if (!Random)
+  {
+    const int StepY = std::max(1, (int)(1.0 / sqrt(Fraction)));
+    const double StepX = 1.0 / (Fraction * StepY);
+    const double OffsetX = std::min(StepX / 2, Image.cols - 1.0);
+    const int OffsetY = std::min(StepY / 2, Image.rows - 1);
+
+    for (int y = OffsetY; y < Image.rows; y += StepY)
+    {
+      const uchar* pRow = Image.ptr(y);
+      size_t Count = 0;
+
+      for (double PosX = OffsetX; PosX < Image.cols; PosX += StepX, ++Count)
+      {
+        const int x = (int)PosX;
+
+        for (int c = 0; c < Channels; ++c)
+        {
+          Buffer[Count * Channels + c] = pRow[x * Channels + c];
+        }
+      }
+
+      Visitor(&Buffer[0], Count);
+      Sampled += Count;
+    }
+
+    return Sampled;
+  }
+
+  // The gap between two sampled pixels is geometrically distributed, so the
+  // next sample can be jumped to directly instead of testing every pixel
+  RNG Rng(Seed);
+  const double LogKeep = log1p(-Fraction);
+  const size_t Total = Image.total();
+  size_t Next = GetSampleGap(Rng, LogKeep, Total);
+
+  for (int y = 0; y < Image.rows; ++y)
+  {
+    const uchar* pRow = Image.ptr(y);
+    const size_t RowStart = (size_t)y * Image.cols;
+    const size_t RowEnd = RowStart + Image.cols;
+    size_t Count = 0;
+
+    while (Next < RowEnd)
+    {
+      const uchar* pPixel = pRow + (Next - RowStart) * Channels;
+      for (int c = 0; c < Channels; ++c)
+      {
+        Buffer[Count * Channels + c] = pPixel[c];
+      }
+      Count++;
+
+      Next += 1 + GetSampleGap(Rng, LogKeep, Total);
+    }
+
+    Visitor(&Buffer[0], Count);
+    Sampled += Count;
+  }
+
+  return Sampled;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+class CValueVisitor
+{
+  public:
+    CValueVisitor(CValueCounter& Counter, int Channels) :
+      mCounter(Counter),
+      mChannels(Channels)
+    {
+    }
+
+    void operator()(const uchar* pPixels, size_t Count)
+    {
+      mCounter.AddPixels(pPixels, Count, mChannels);
+    }
+
+  private:
+    CValueCounter& mCounter;
+    int mChannels;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+class CBGRVisitor
+{
+  public:
+    CBGRVisitor(CBGRCounter& Counter, int Channels) :
+      mCounter(Counter),
+      mChannels(Channels)
+    {
+    }
+
+    void operator()(const uchar* pPixels, size_t Count)
+    {
+      mCounter.AddPixels(pPixels, Count, mChannels);
+    }
+
+  private:
+    CBGRCounter& mCounter;
+    int mChannels;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+size_t SampleValue(
+  const Mat& Image,
+  bool Random,
+  double Fraction,
+  unsigned Seed,
+  CValueCounter& Counter)
+{
+  CValueVisitor Visitor(Counter, Image.channels());
+
+  return VisitSamples(Image, Random, Fraction, Seed, Visitor);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+size_t SampleBGR(
+  const Mat& Image,
+  bool Random,
+  double Fraction,
+  unsigned Seed,
+  CBGRCounter& Counter)
+{
+  CBGRVisitor Visitor(Counter, Image.channels());
+
+  return VisitSamples(Image, Random, Fraction, Seed, Visitor);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+int GetBandCount(const Mat& Image, unsigned ThreadCount)
+{
+  int Threads = (ThreadCount == 0) ? getNumThreads() : (int)ThreadCount;
+  int MaxBands = Image.rows / HIST_LIB_MIN_BAND_ROWS;
+
+  return std::max(1, std::min(Threads, MaxBands));
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+int GetStripeCount(int Jobs, unsigned ThreadCount)
+{
+  int Threads = (ThreadCount == 0) ? getNumThreads() : (int)ThreadCount;
+
+  return std::max(1, std::min(Threads, Jobs));
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+int GetBandStart(int Rows, int BandCount, int Band)
+{
+  return (int)(((int64)Rows * Band) / BandCount);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Parallel body that counts one row band per stripe into its own counter
+//-----------------------------------------------------------------------------
+template <class TCounter>
+class CBandCountBody : public ParallelLoopBody
+{
+  public:
+    CBandCountBody(const Mat& Image, std::vector<TCounter>& Counters) :
+      mImage(Image),
+      mCounters(Counters)
+    {
+    }
+
+    virtual void operator()(const Range& Bands) const
+    {
+      const int BandCount = (int)mCounters.size();
+
+      for (int b = Bands.start; b < Bands.end; ++b)
+      {
+        mCounters[b].AddRows(
+          mImage,
+          GetBandStart(mImage.rows, BandCount, b),
+          GetBandStart(mImage.rows, BandCount, b + 1));
+      }
+    }
+
+  private:
+    const Mat& mImage;
+    std::vector<TCounter>& mCounters;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountBGR(
+  const Mat& Image,
+  int BandCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR,
+  std::vector<CBGRCounter>* pScratch)
+{
+  if (BandCount <= 1)
+  {
+    CBGRCounter Counter;
+    Counter.AddRows(Image, 0, Image.rows);
+    Counter.Reduce(CountsB, CountsG, CountsR);
+    return;
+  }
+
+  std::vector<CBGRCounter> LocalCounters;
+  std::vector<CBGRCounter>& Counters = pScratch ? *pScratch : LocalCounters;
+
+  // Resizing keeps the capacity, so a reused scratch vector does not allocate
+  Counters.resize(BandCount);
+  for (int b = 0; b < BandCount; ++b)
+  {
+    Counters[b].Clear();
+  }
+
+  parallel_for_(
+    Range(0, BandCount),
+    CBandCountBody<CBGRCounter>(Image, Counters),
+    BandCount);
+
+  // Reduce in band order so the result never depends on scheduling
+  for (int b = 0; b < BandCount; ++b)
+  {
+    Counters[b].Reduce(CountsB, CountsG, CountsR);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountValue(
+  const Mat& Image,
+  int BandCount,
+  unsigned* Counts,
+  std::vector<CValueCounter>* pScratch)
+{
+  if (BandCount <= 1)
+  {
+    CValueCounter Counter;
+    Counter.AddRows(Image, 0, Image.rows);
+    Counter.Reduce(Counts);
+    return;
+  }
+
+  std::vector<CValueCounter> LocalCounters;
+  std::vector<CValueCounter>& Counters = pScratch ? *pScratch : LocalCounters;
+
+  Counters.resize(BandCount);
+  for (int b = 0; b < BandCount; ++b)
+  {
+    Counters[b].Clear();
+  }
+
+  parallel_for_(
+    Range(0, BandCount),
+    CBandCountBody<CValueCounter>(Image, Counters),
+    BandCount);
+
+  for (int b = 0; b < BandCount; ++b)
+  {
+    Counters[b].Reduce(Counts);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CCompactCounter::CCompactCounter(bool IsBGR) :
+  mIsBGR(IsBGR),
+  mPending(0)
+{
+  memset(mCounts, 0, sizeof(mCounts));
+  memset(mTotals, 0, sizeof(mTotals));
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts a horizontal band of the image in pieces that never take the
+//   pending count past USHRT_MAX
+//-----------------------------------------------------------------------------
+void CCompactCounter::AddRows(const Mat& Image, int RowBegin, int RowEnd)
+{
+  const int Channels = Image.channels();
+
+  int Rows = RowEnd - RowBegin;
+  size_t Width = Image.cols;
+
+  if (Image.isContinuous())
+  {
+    Width *= Rows;
+    Rows = 1;
+  }
+
+  for (int y = RowBegin; y < RowBegin + Rows; ++y)
+  {
+    const uchar* p = Image.ptr(y);
+
+    for (size_t x = 0; x < Width;)
+    {
+      if (mPending == USHRT_MAX)
+      {
+        Flush();
+      }
+
+      const size_t Count = std::min(
+        (size_t)(USHRT_MAX - mPending),
+        Width - x);
+
+      AddPixels(p + x * Channels, Count, Channels);
+      mPending += (unsigned)Count;
+      x += Count;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CCompactCounter::AddPixels(const uchar* p, size_t Width, int Channels)
+{
+  if (!mIsBGR)
+  {
+    if (Channels == 1)
+    {
+      AddValues(p, Width);
+      return;
+    }
+
+    uchar Value[HIST_LIB_VALUE_CHUNK];
+
+    for (size_t x = 0; x < Width; x += HIST_LIB_VALUE_CHUNK)
+    {
+      const size_t Count = std::min((size_t)HIST_LIB_VALUE_CHUNK, Width - x);
+
+      ComputeValuePixels(p + x * Channels, Value, Count, Channels);
+      AddValues(Value, Count);
+    }
+    return;
+  }
+
+  unsigned short (*B)[HIST_LIB_LEVELS] = mCounts[0];
+  unsigned short (*G)[HIST_LIB_LEVELS] = mCounts[1];
+  unsigned short (*R)[HIST_LIB_LEVELS] = mCounts[2];
+
+  const int C = Channels;
+  size_t x = 0;
+
+  for (; x + 4 <= Width; x += 4, p += 4 * C)
+  {
+    B[0][p[0]]++;       G[0][p[1]]++;       R[0][p[2]]++;
+    B[1][p[C]]++;       G[1][p[C+1]]++;     R[1][p[C+2]]++;
+    B[2][p[2*C]]++;     G[2][p[2*C+1]]++;   R[2][p[2*C+2]]++;
+    B[3][p[3*C]]++;     G[3][p[3*C+1]]++;   R[3][p[3*C+2]]++;
+  }
+
+  for (; x < Width; ++x, p += C)
+  {
+    B[0][p[0]]++;
+    G[0][p[1]]++;
+    R[0][p[2]]++;
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CCompactCounter::AddValues(const uchar* p, size_t Width)
+{
+  unsigned short (*V)[HIST_LIB_LEVELS] = mCounts[0];
+  size_t x = 0;
+
+  for (; x + 4 <= Width; x += 4, p += 4)
+  {
+    V[0][p[0]]++;
+    V[1][p[1]]++;
+    V[2][p[2]]++;
+    V[3][p[3]]++;
+  }
+
+  for (; x < Width; ++x, ++p)
+  {
+    V[0][p[0]]++;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Promotes the 16-bit sub-histograms into the 64-bit totals
+//-----------------------------------------------------------------------------
+void CCompactCounter::Flush()
+{
+  const int HistCount = mIsBGR ? 3 : 1;
+
+  for (int c = 0; c < HistCount; ++c)
+  {
+    for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      unsigned Sum = 0;
+      for (int s = 0; s < HIST_LIB_SUB_HISTS; ++s)
+      {
+        Sum += mCounts[c][s][i];
+      }
+      mTotals[c][i] += Sum;
+    }
+  }
+
+  memset(mCounts, 0, sizeof(mCounts));
+  mPending = 0;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CCompactCounter::Reduce(
+  uint64* CountsB,
+  uint64* CountsG,
+  uint64* CountsR)
+{
+  Flush();
+
+  uint64* Out[3] = {CountsB, CountsG, CountsR};
+
+  for (int c = 0; c < (mIsBGR ? 3 : 1); ++c)
+  {
+    for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      Out[c][i] += mTotals[c][i];
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountCompact(
+  const Mat& Image,
+  bool IsBGR,
+  int BandCount,
+  uint64* CountsB,
+  uint64* CountsG,
+  uint64* CountsR,
+  std::vector<CCompactCounter>* pScratch)
+{
+  std::vector<CCompactCounter> LocalCounters;
+  std::vector<CCompactCounter>& Counters = pScratch ? *pScratch : LocalCounters;
+
+  Counters.assign(std::max(BandCount, 1), CCompactCounter(IsBGR));
+
+  CBandCountBody<CCompactCounter> Body(Image, Counters);
+
+  if (Counters.size() == 1)
+  {
+    Body(Range(0, 1));
+  }
+  else
+  {
+    parallel_for_(Range(0, BandCount), Body, BandCount);
+  }
+
+  for (size_t b = 0; b < Counters.size(); ++b)
+  {
+    Counters[b].Reduce(CountsB, CountsG, CountsR);
+  }
+}
+
+// BT.601 video range coefficients in 20-bit fixed point, the same ones
+// cvtColor uses for COLOR_YUV2BGR_NV12 and friends
+#define HIST_LIB_YUV_SHIFT 20
+#define HIST_LIB_YUV_CY    1220542
+#define HIST_LIB_YUV_CUB   2116026
+#define HIST_LIB_YUV_CUG   (-409993)
+#define HIST_LIB_YUV_CVG   (-852492)
+#define HIST_LIB_YUV_CVR   1673527
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Every chroma sample is shared by two horizontally neighbouring pixels,
+//   so its contributions are computed once per pair
+//-----------------------------------------------------------------------------
+void ConvertYUVPixels(
+  const CYUVPlanes& Planes,
+  int Row,
+  int x,
+  int Count,
+  uchar* pBGR)
+{
+  const int Half = 1 << (HIST_LIB_YUV_SHIFT - 1);
+
+  const uchar* pY = Planes.pY + Row * Planes.YStep + x;
+  const size_t UVOffset = (Row / 2) * Planes.UVStep
+    + (x / 2) * Planes.UVPixelStep;
+  const uchar* pU = Planes.pU + UVOffset;
+  const uchar* pV = Planes.pV + UVOffset;
+
+  for (int i = 0; i < Count; i += 2)
+  {
+    const int u = (int)*pU - 128;
+    const int v = (int)*pV - 128;
+    pU += Planes.UVPixelStep;
+    pV += Planes.UVPixelStep;
+
+    const int ruv = Half + HIST_LIB_YUV_CVR * v;
+    const int guv = Half + HIST_LIB_YUV_CVG * v + HIST_LIB_YUV_CUG * u;
+    const int buv = Half + HIST_LIB_YUV_CUB * u;
+
+    for (int k = 0; (k < 2) && (i + k < Count); ++k, pBGR += 3)
+    {
+      const int y = std::max(0, (int)pY[i + k] - 16) * HIST_LIB_YUV_CY;
+
+      pBGR[0] = saturate_cast<uchar>((y + buv) >> HIST_LIB_YUV_SHIFT);
+      pBGR[1] = saturate_cast<uchar>((y + guv) >> HIST_LIB_YUV_SHIFT);
+      pBGR[2] = saturate_cast<uchar>((y + ruv) >> HIST_LIB_YUV_SHIFT);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Parallel body that converts the rows of one band a chunk at a time into a
+//   stack buffer and counts them.  Bands always start on an even row so that
+//   no chroma row is shared between bands.
+//-----------------------------------------------------------------------------
+template <class TCounter>
+class CYUVBandBody : public ParallelLoopBody
+{
+  public:
+    CYUVBandBody(const CYUVPlanes& Planes, std::vector<TCounter>& Counters) :
+      mPlanes(Planes),
+      mCounters(Counters)
+    {
+    }
+
+    virtual void operator()(const Range& Bands) const
+    {
+      const int BandCount = (int)mCounters.size();
+      const int ChromaRows = mPlanes.Height / 2;
+
+      uchar BGR[3 * HIST_LIB_VALUE_CHUNK];
+
+      for (int b = Bands.start; b < Bands.end; ++b)
+      {
+        const int RowBegin = 2 * GetBandStart(ChromaRows, BandCount, b);
+        const int RowEnd = 2 * GetBandStart(ChromaRows, BandCount, b + 1);
+
+        for (int y = RowBegin; y < RowEnd; ++y)
+        {
+          for (int x = 0; x < mPlanes.Width; x += HIST_LIB_VALUE_CHUNK)
+          {
+            const int Count = std::min(HIST_LIB_VALUE_CHUNK, mPlanes.Width - x);
+
+            ConvertYUVPixels(mPlanes, y, x, Count, BGR);
+            mCounters[b].AddPixels(BGR, Count, 3);
+          }
+        }
+      }
+    }
+
+  private:
+    const CYUVPlanes& mPlanes;
+    std::vector<TCounter>& mCounters;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountYUVBGR(
+  const CYUVPlanes& Planes,
+  int BandCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR)
+{
+  std::vector<CBGRCounter> Counters(std::max(BandCount, 1));
+  CYUVBandBody<CBGRCounter> Body(Planes, Counters);
+
+  if (Counters.size() == 1)
+  {
+    Body(Range(0, 1));
+  }
+  else
+  {
+    parallel_for_(Range(0, BandCount), Body, BandCount);
+  }
+
+  for (size_t b = 0; b < Counters.size(); ++b)
+  {
+    Counters[b].Reduce(CountsB, CountsG, CountsR);
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountYUVValue(const CYUVPlanes& Planes, int BandCount, unsigned* Counts)
+{
+  std::vector<CValueCounter> Counters(std::max(BandCount, 1));
+  CYUVBandBody<CValueCounter> Body(Planes, Counters);
+
+  if (Counters.size() == 1)
+  {
+    Body(Range(0, 1));
+  }
+  else
+  {
+    parallel_for_(Range(0, BandCount), Body, BandCount);
+  }
+
+  for (size_t b = 0; b < Counters.size(); ++b)
+  {
+    Counters[b].Reduce(Counts);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Planar chroma rows are counted directly; interleaved rows are split into
+//   U and V a chunk at a time first
+//-----------------------------------------------------------------------------
+void CountYUVChroma(
+  const CYUVPlanes& Planes,
+  unsigned* CountsU,
+  unsigned* CountsV)
+{
+  const int ChromaWidth = Planes.Width / 2;
+  const int ChromaRows = Planes.Height / 2;
+
+  CValueCounter CounterU;
+  CValueCounter CounterV;
+
+  uchar U[HIST_LIB_VALUE_CHUNK];
+  uchar V[HIST_LIB_VALUE_CHUNK];
+
+  for (int c = 0; c < ChromaRows; ++c)
+  {
+    const uchar* pU = Planes.pU + c * Planes.UVStep;
+    const uchar* pV = Planes.pV + c * Planes.UVStep;
+
+    if (Planes.UVPixelStep == 1)
+    {
+      CounterU.AddPixels(pU, ChromaWidth);
+      CounterV.AddPixels(pV, ChromaWidth);
+      continue;
+    }
+
+    for (int x = 0; x < ChromaWidth; x += HIST_LIB_VALUE_CHUNK)
+    {
+      const int Count = std::min(HIST_LIB_VALUE_CHUNK, ChromaWidth - x);
+
+      for (int i = 0; i < Count; ++i)
+      {
+        U[i] = pU[(x + i) * Planes.UVPixelStep];
+        V[i] = pV[(x + i) * Planes.UVPixelStep];
+      }
+
+      CounterU.AddPixels(U, Count);
+      CounterV.AddPixels(V, Count);
+    }
+  }
+
+  CounterU.Reduce(CountsU);
+  CounterV.Reduce(CountsV);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Parallel body that counts whole rows of tiles.  Every tile row owns its
+//   own counters, so stripes never share state and no reduction is needed.
+//-----------------------------------------------------------------------------
+class CTileCountBody : public ParallelLoopBody
+{
+  public:
+    CTileCountBody(
+      const Mat& Image,
+      int TilesX,
+      int TilesY,
+      unsigned* CountsB,
+      unsigned* CountsG,
+      unsigned* CountsR) :
+      mImage(Image),
+      mTilesX(TilesX),
+      mTilesY(TilesY),
+      mCountsB(CountsB),
+      mCountsG(CountsG),
+      mCountsR(CountsR)
+    {
+    }
+
+    virtual void operator()(const Range& TileRows) const
+    {
+      const int Channels = mImage.channels();
+      const bool IsBGR = (mCountsG != 0);
+
+      std::vector<uchar> Value(mImage.cols);
+
+      for (int ty = TileRows.start; ty < TileRows.end; ++ty)
+      {
+        const int yBegin = GetBandStart(mImage.rows, mTilesY, ty);
+        const int yEnd = GetBandStart(mImage.rows, mTilesY, ty + 1);
+
+        for (int y = yBegin; y < yEnd; ++y)
+        {
+          const uchar* pRow = mImage.ptr(y);
+
+          if (!IsBGR && (Channels != 1))
+          {
+            ComputeValuePixels(pRow, &Value[0], mImage.cols, Channels);
+            pRow = &Value[0];
+          }
+
+          for (int tx = 0; tx < mTilesX; ++tx)
+          {
+            const size_t Tile = (size_t)ty * mTilesX + tx;
+            const int xBegin = GetBandStart(mImage.cols, mTilesX, tx);
+            const int xEnd = GetBandStart(mImage.cols, mTilesX, tx + 1);
+
+            if (IsBGR)
+            {
+              unsigned* pB = mCountsB + Tile * HIST_LIB_LEVELS;
+              unsigned* pG = mCountsG + Tile * HIST_LIB_LEVELS;
+              unsigned* pR = mCountsR + Tile * HIST_LIB_LEVELS;
+              const uchar* p = pRow + xBegin * Channels;
+
+              for (int x = xBegin; x < xEnd; ++x, p += Channels)
+              {
+                pB[p[0]]++;
+                pG[p[1]]++;
+                pR[p[2]]++;
+              }
+            }
+            else
+            {
+              unsigned* pCounts = mCountsB + Tile * HIST_LIB_LEVELS;
+
+              for (int x = xBegin; x < xEnd; ++x)
+              {
+                pCounts[pRow[x]]++;
+              }
+            }
+          }
+        }
+      }
+    }
+
+  private:
+    const Mat& mImage;
+    int mTilesX;
+    int mTilesY;
+    unsigned* mCountsB;
+    unsigned* mCountsG;
+    unsigned* mCountsR;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountValueTiles(
+  const Mat& Image,
+  int TilesX,
+  int TilesY,
+  unsigned ThreadCount,
+  unsigned* Counts)
+{
+  CTileCountBody Body(Image, TilesX, TilesY, Counts, 0, 0);
+  const int StripeCount = GetStripeCount(TilesY, ThreadCount);
+
+  if (StripeCount > 1)
+  {
+    parallel_for_(Range(0, TilesY), Body, StripeCount);
+  }
+  else
+  {
+    Body(Range(0, TilesY));
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountBGRTiles(
+  const Mat& Image,
+  int TilesX,
+  int TilesY,
+  unsigned ThreadCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR)
+{
+  CTileCountBody Body(Image, TilesX, TilesY, CountsB, CountsG, CountsR);
+  const int StripeCount = GetStripeCount(TilesY, ThreadCount);
+
+  if (StripeCount > 1)
+  {
+    parallel_for_(Range(0, TilesY), Body, StripeCount);
+  }
+  else
+  {
+    Body(Range(0, TilesY));
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CWideCounter::CWideCounter() :
+  mBinCount(0),
+  mBlockCount(0),
+  mHistCount(0),
+  mLow(0),
+  mScale(0),
+  mShift(-1),
+  mLowValue(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CWideCounter::Reset(
+  unsigned BinCount,
+  double Low,
+  double High,
+  bool IsBGR)
+{
+  mBinCount = BinCount;
+  mBlockCount = (BinCount + HIST_LIB_FINE_BLOCK - 1) / HIST_LIB_FINE_BLOCK;
+  mHistCount = IsBGR ? 3 : 1;
+  mLow = Low;
+  mScale = BinCount / (High - Low);
+  mShift = -1;
+  mLowValue = 0;
+  mFine.assign(mHistCount * BinCount, 0);
+  mTotals.assign(mHistCount * BinCount, 0);
+  mCoarse.assign(mHistCount * mBlockCount, 0);
+
+  // The default 16-bit range [0, 65536) with 256, 1024 or 65536 bins (any
+  // power of two) takes the shift path
+  if ((Low >= 0) && (High <= 65536) && (Low == std::floor(Low)))
+  {
+    for (int Shift = 0; Shift <= 16; ++Shift)
+    {
+      if ((double)BinCount * (1 << Shift) == High - Low)
+      {
+        mShift = Shift;
+        mLowValue = (unsigned)Low;
+        break;
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Picks the kernel once per band.  16-bit images with power of two bins
+//   use a kernel specialised for their shift, which bins with a subtract and
+//   a constant shift instead of a floating point multiply and conversion.
+//-----------------------------------------------------------------------------
+void CWideCounter::AddRows(const Mat& Image, int RowBegin, int RowEnd)
+{
+  typedef void (CWideCounter::*TKernel)(const Mat&, int, int);
+
+  static const TKernel ShiftedKernels[] =
+  {
+    &CWideCounter::AddRowsShifted<0>,
+    &CWideCounter::AddRowsShifted<1>,
+    &CWideCounter::AddRowsShifted<2>,
+    &CWideCounter::AddRowsShifted<3>,
+    &CWideCounter::AddRowsShifted<4>,
+    &CWideCounter::AddRowsShifted<5>,
+    &CWideCounter::AddRowsShifted<6>,
+    &CWideCounter::AddRowsShifted<7>,
+    &CWideCounter::AddRowsShifted<8>,
+    &CWideCounter::AddRowsShifted<9>,
+    &CWideCounter::AddRowsShifted<10>,
+    &CWideCounter::AddRowsShifted<11>,
+    &CWideCounter::AddRowsShifted<12>,
+    &CWideCounter::AddRowsShifted<13>,
+    &CWideCounter::AddRowsShifted<14>,
+    &CWideCounter::AddRowsShifted<15>,
+    &CWideCounter::AddRowsShifted<16>
+  };
+
+  if (Image.depth() == CV_16U)
+  {
+    if (mShift >= 0)
+    {
+      (this->*ShiftedKernels[mShift])(Image, RowBegin, RowEnd);
+    }
+    else
+    {
+      AddRowsOfType<ushort>(Image, RowBegin, RowEnd);
+    }
+  }
+  else
+  {
+    AddRowsOfType<float>(Image, RowBegin, RowEnd);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Values below Low wrap around to bins far above mBinCount and values at or
+//   above High shift to mBinCount or more, so a single unsigned compare in
+//   AddBin() is the whole range test.  The bins are identical to the ones
+//   Add() computes, since (Value - Low) * mScale is exact for these ranges.
+//-----------------------------------------------------------------------------
+template <unsigned Shift>
+void CWideCounter::AddRowsShifted(const Mat& Image, int RowBegin, int RowEnd)
+{
+  const int Channels = Image.channels();
+  const unsigned Low = mLowValue;
+
+  for (int y = RowBegin; y < RowEnd; ++y)
+  {
+    const ushort* p = Image.ptr<ushort>(y);
+
+    if (mHistCount == 3)
+    {
+      for (int x = 0; x < Image.cols; ++x, p += Channels)
+      {
+        AddBin(0, (p[0] - Low) >> Shift);
+        AddBin(1, (p[1] - Low) >> Shift);
+        AddBin(2, (p[2] - Low) >> Shift);
+      }
+    }
+    else if (Channels == 1)
+    {
+      for (int x = 0; x < Image.cols; ++x)
+      {
+        AddBin(0, (p[x] - Low) >> Shift);
+      }
+    }
+    else
+    {
+      for (int x = 0; x < Image.cols; ++x, p += Channels)
+      {
+        const unsigned Value = std::max(p[0], std::max(p[1], p[2]));
+        AddBin(0, (Value - Low) >> Shift);
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+template <typename T>
+void CWideCounter::AddRowsOfType(const Mat& Image, int RowBegin, int RowEnd)
+{
+  const int Channels = Image.channels();
+
+  for (int y = RowBegin; y < RowEnd; ++y)
+  {
+    const T* p = Image.ptr<T>(y);
+
+    if (mHistCount == 3)
+    {
+      for (int x = 0; x < Image.cols; ++x, p += Channels)
+      {
+        Add(0, p[0]);
+        Add(1, p[1]);
+        Add(2, p[2]);
+      }
+    }
+    else if (Channels == 1)
+    {
+      for (int x = 0; x < Image.cols; ++x)
+      {
+        Add(0, p[x]);
+      }
+    }
+    else
+    {
+      for (int x = 0; x < Image.cols; ++x, p += Channels)
+      {
+        Add(0, std::max(p[0], std::max(p[1], p[2])));
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Values outside [Low, High) (and NaNs) fail the range test and are skipped
+//-----------------------------------------------------------------------------
+inline void CWideCounter::Add(unsigned Hist, double Value)
+{
+  const double Position = (Value - mLow) * mScale;
+
+  if ((Position >= 0) && (Position < mBinCount))
+  {
+    AddBin(Hist, (unsigned)Position);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Bins at or above mBinCount are skipped
+//-----------------------------------------------------------------------------
+inline void CWideCounter::AddBin(unsigned Hist, unsigned Bin)
+{
+  if (Bin < mBinCount)
+  {
+    const unsigned Block = Hist * mBlockCount + Bin / HIST_LIB_FINE_BLOCK;
+
+    mFine[Hist * mBinCount + Bin]++;
+
+    if (++mCoarse[Block] == USHRT_MAX)
+    {
+      FlushBlock(Block);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Moves the fine counts of one coarse block into the 32-bit totals
+//-----------------------------------------------------------------------------
+void CWideCounter::FlushBlock(unsigned Block)
+{
+  const unsigned Hist = Block / mBlockCount;
+  const unsigned First = (Block % mBlockCount) * HIST_LIB_FINE_BLOCK;
+  const unsigned Last = std::min(First + HIST_LIB_FINE_BLOCK, mBinCount);
+
+  unsigned short* pFine = &mFine[Hist * mBinCount];
+  unsigned* pTotals = &mTotals[Hist * mBinCount];
+
+  for (unsigned i = First; i < Last; ++i)
+  {
+    pTotals[i] += pFine[i];
+    pFine[i] = 0;
+  }
+
+  mCoarse[Block] = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Only blocks that received samples since their last flush are visited
+//-----------------------------------------------------------------------------
+void CWideCounter::Reduce(
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR)
+{
+  for (unsigned Block = 0; Block < mHistCount * mBlockCount; ++Block)
+  {
+    if (mCoarse[Block])
+    {
+      FlushBlock(Block);
+    }
+  }
+
+  unsigned* Out[3] = {CountsB, CountsG, CountsR};
+
+  for (unsigned h = 0; h < mHistCount; ++h)
+  {
+    const unsigned* pTotals = &mTotals[h * mBinCount];
+
+    for (unsigned i = 0; i < mBinCount; ++i)
+    {
+      Out[h][i] += pTotals[i];
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CountWide(
+  const Mat& Image,
+  unsigned BinCount,
+  double Low,
+  double High,
+  bool IsBGR,
+  int BandCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR,
+  std::vector<CWideCounter>* pScratch)
+{
+  BandCount = std::max(1, BandCount);
+
+  std::vector<CWideCounter> LocalCounters;
+  std::vector<CWideCounter>& Counters = pScratch ? *pScratch : LocalCounters;
+
+  Counters.resize(BandCount);
+  for (int b = 0; b < BandCount; ++b)
+  {
+    Counters[b].Reset(BinCount, Low, High, IsBGR);
+  }
+
+  CBandCountBody<CWideCounter> Body(Image, Counters);
+
+  if (BandCount == 1)
+  {
+    Body(Range(0, 1));
+  }
+  else
+  {
+    parallel_for_(Range(0, BandCount), Body, BandCount);
+  }
+
+  for (int b = 0; b < BandCount; ++b)
+  {
+    Counters[b].Reduce(CountsB, CountsG, CountsR);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Every entry is computed with the same double expression and clipping the
+//   normalization functions used per pixel, so images mapped through the
+//   table are bit-identical to the per pixel results
+//-----------------------------------------------------------------------------
+void BuildStretchLut(double Min, double Scale, uchar* pLut)
+{
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    const double Value = ((double)i - Min) * Scale;
+
+    if (Value > 255) // Take care of positive clipping
+    {
+      pLut[i] = 255;
+    }
+    else if (Value < 0) // Take care of negative clipping
+    {
+      pLut[i] = 0;
+    }
+    else // If there is no clipping
+    {
+      pLut[i] = (uchar)cvRound(Value);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Scaling B, G and R by the same factor keeps hue and saturation.  With
+//   the factor rounded to 16.16 fixed point the channel holding the value
+//   lands exactly on Stretch[V] (the rounding error is at most V / 2 out of
+//   2^16), and the other channels never exceed it, so nothing overflows.
+//-----------------------------------------------------------------------------
+void BuildValueScales(const uchar* pStretch, unsigned* pScales)
+{
+  // A pixel with value 0 is black and stays black
+  pScales[0] = 0;
+
+  for (unsigned v = 1; v < HIST_LIB_LEVELS; ++v)
+  {
+    pScales[v] = ((pStretch[v] << 16) + v / 2) / v;
+  }
+}
+
+#if CV_SIMD128
+//-----------------------------------------------------------------------------
+// Description:
+//   Scales 16 samples of one channel by their 16.16 factors.  The products
+//   fit 32 bits (a sample never exceeds its pixel's value), and the results
+//   match the scalar formula exactly.
+//-----------------------------------------------------------------------------
+static inline v_uint8x16 ScaleLanes(
+  const v_uint8x16& Samples,
+  const v_uint32x4* Factors)
+{
+  const v_uint32x4 Half = v_setall_u32(1 << 15);
+
+  v_uint16x8 Samples16[2];
+  v_expand(Samples, Samples16[0], Samples16[1]);
+
+  v_uint32x4 Samples32[4];
+  v_expand(Samples16[0], Samples32[0], Samples32[1]);
+  v_expand(Samples16[1], Samples32[2], Samples32[3]);
+
+  for (int i = 0; i < 4; ++i)
+  {
+    Samples32[i] = (Samples32[i] * Factors[i] + Half) >> 16;
+  }
+
+  return v_pack(
+    v_pack(Samples32[0], Samples32[1]),
+    v_pack(Samples32[2], Samples32[3]));
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Description:
+//   The values of a chunk of pixels are computed with ComputeValuePixels()
+//   into a stack buffer.  Each group of 16 pixels then looks up its 16
+//   factors and is deinterleaved, multiplied in 32-bit lanes and packed back;
+//   the remaining pixels use one table lookup and three scalar multiplies.
+//   Pixels are read before they are written.
+//-----------------------------------------------------------------------------
+static void ApplyValueScaleRows(
+  const Mat& Image,
+  Mat& ImageNorm,
+  const unsigned* pScales,
+  int RowBegin,
+  int RowEnd)
+{
+  const int Channels = Image.channels();
+
+  int Rows = RowEnd - RowBegin;
+  size_t Width = Image.cols;
+
+  if (Image.isContinuous() && ImageNorm.isContinuous())
+  {
+    Width *= Rows;
+    Rows = 1;
+  }
+
+  uchar Value[HIST_LIB_VALUE_CHUNK];
+
+  for (int y = RowBegin; y < RowBegin + Rows; ++y)
+  {
+    const uchar* pRow = Image.ptr(y);
+    uchar* pRowNorm = ImageNorm.ptr(y);
+
+    for (size_t x = 0; x < Width; x += HIST_LIB_VALUE_CHUNK)
+    {
+      const size_t Count = std::min((size_t)HIST_LIB_VALUE_CHUNK, Width - x);
+      const uchar* p = pRow + x * Channels;
+      uchar* pNorm = pRowNorm + x * Channels;
+
+      ComputeValuePixels(p, Value, Count, Channels);
+
+      size_t i = 0;
+
+#if CV_SIMD128
+      for (; i + 16 <= Count; i += 16)
+      {
+        unsigned Factors[16];
+        for (int k = 0; k < 16; ++k)
+        {
+          Factors[k] = pScales[Value[i + k]];
+        }
+
+        v_uint32x4 FactorLanes[4];
+        for (int k = 0; k < 4; ++k)
+        {
+          FactorLanes[k] = v_load(Factors + 4 * k);
+        }
+
+        v_uint8x16 Lanes[4];
+
+        if (Channels == 3)
+        {
+          v_load_deinterleave(p + 3 * i, Lanes[0], Lanes[1], Lanes[2]);
+        }
+        else
+        {
+          v_load_deinterleave(
+            p + 4 * i,
+            Lanes[0],
+            Lanes[1],
+            Lanes[2],
+            Lanes[3]);
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+          Lanes[c] = ScaleLanes(Lanes[c], FactorLanes);
+        }
+
+        if (Channels == 3)
+        {
+          v_store_interleave(pNorm + 3 * i, Lanes[0], Lanes[1], Lanes[2]);
+        }
+        else
+        {
+          v_store_interleave(
+            pNorm + 4 * i,
+            Lanes[0],
+            Lanes[1],
+            Lanes[2],
+            Lanes[3]);
+        }
+      }
+#endif
+
+      p += i * Channels;
+      pNorm += i * Channels;
+
+      for (; i < Count; ++i, p += Channels, pNorm += Channels)
+      {
+        const unsigned Scale = pScales[Value[i]];
+
+        pNorm[0] = (uchar)((p[0] * Scale + (1 << 15)) >> 16);
+        pNorm[1] = (uchar)((p[1] * Scale + (1 << 15)) >> 16);
+        pNorm[2] = (uchar)((p[2] * Scale + (1 << 15)) >> 16);
+
+        if (Channels == 4)
+        {
+          pNorm[3] = p[3];
+        }
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Parallel body that rescales one row band per stripe.  Every pixel is
+//   mapped on its own, so the result does not depend on the banding.
+//-----------------------------------------------------------------------------
+class CValueScaleBody : public ParallelLoopBody
+{
+  public:
+    CValueScaleBody(
+      const Mat& Image,
+      Mat& ImageNorm,
+      const unsigned* pScales,
+      int BandCount) :
+      mImage(Image),
+      mImageNorm(ImageNorm),
+      mpScales(pScales),
+      mBandCount(BandCount)
+    {
+    }
+
+    virtual void operator()(const Range& Bands) const
+    {
+      for (int b = Bands.start; b < Bands.end; ++b)
+      {
+        ApplyValueScaleRows(
+          mImage,
+          mImageNorm,
+          mpScales,
+          GetBandStart(mImage.rows, mBandCount, b),
+          GetBandStart(mImage.rows, mBandCount, b + 1));
+      }
+    }
+
+  private:
+    const Mat& mImage;
+    Mat& mImageNorm;
+    const unsigned* mpScales;
+    int mBandCount;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void ApplyValueScales(
+  const Mat& Image,
+  Mat& ImageNorm,
+  const unsigned* pScales,
+  int BandCount)
+{
+  ImageNorm.create(Image.size(), Image.type());
+
+  if (BandCount <= 1)
+  {
+    ApplyValueScaleRows(Image, ImageNorm, pScales, 0, Image.rows);
+    return;
+  }
+
+  parallel_for_(
+    Range(0, BandCount),
+    CValueScaleBody(Image, ImageNorm, pScales, BandCount),
+    BandCount);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Rounded to nearest, so the factor is off by at most 2^-17 and the stretch
+//   of an offset of up to 255 by less than 2^-9 before the final rounding.
+//   Over every Range in [1, 255] and every offset this never moves the result
+//   more than 0.5 from the exact value.
+//-----------------------------------------------------------------------------
+unsigned GetStretchFactor(unsigned Range)
+{
+  return ((255u << 16) + Range / 2) / Range;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void BuildFixedStretchLut(unsigned Low, unsigned Range, uchar* pLut)
+{
+  if (Range == 0)
+  {
+    for (unsigned i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      pLut[i] = (i > Low) ? 255 : 0;
+    }
+    return;
+  }
+
+  const unsigned Factor = GetStretchFactor(Range);
+
+  for (unsigned i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    const unsigned Offset = std::min((i > Low) ? i - Low : 0, Range);
+
+    pLut[i] = (uchar)((Offset * Factor + (1 << 15)) >> 16);
+  }
+}
+
+#if CV_SIMD128
+//-----------------------------------------------------------------------------
+// Description:
+//   Stretches 16 samples of one channel.  The subtraction saturates at 0 and
+//   the offset is clamped to Range, so the products fit 24 bits and the
+//   results fit 8 bits before packing.
+//-----------------------------------------------------------------------------
+static inline v_uint8x16 StretchLanes(
+  const v_uint8x16& Samples,
+  const v_uint8x16& Low,
+  const v_uint8x16& Range,
+  const v_uint32x4& Factor)
+{
+  const v_uint8x16 Offset = v_min(Samples - Low, Range);
+  const v_uint32x4 Half = v_setall_u32(1 << 15);
+
+  v_uint16x8 Offset16[2];
+  v_expand(Offset, Offset16[0], Offset16[1]);
+
+  v_uint32x4 Offset32[4];
+  v_expand(Offset16[0], Offset32[0], Offset32[1]);
+  v_expand(Offset16[1], Offset32[2], Offset32[3]);
+
+  for (int i = 0; i < 4; ++i)
+  {
+    Offset32[i] = (Offset32[i] * Factor + Half) >> 16;
+  }
+
+  return v_pack(
+    v_pack(Offset32[0], Offset32[1]),
+    v_pack(Offset32[2], Offset32[3]));
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Deinterleaves 16 pixels at a time and stretches every channel with
+//   integer arithmetic only; the remaining pixels go through the scalar form
+//   of the same formula
+//-----------------------------------------------------------------------------
+static void ApplyChannelStretchRows(
+  const Mat& Image,
+  Mat& ImageNorm,
+  const uchar* pLow,
+  const uchar* pRange,
+  int RowBegin,
+  int RowEnd)
+{
+  const int Channels = Image.channels();
+
+  int Rows = RowEnd - RowBegin;
+  size_t Width = Image.cols;
+
+  if (Image.isContinuous() && ImageNorm.isContinuous())
+  {
+    Width *= Rows;
+    Rows = 1;
+  }
+
+  unsigned Factor[3];
+  for (int c = 0; c < 3; ++c)
+  {
+    Factor[c] = GetStretchFactor(pRange[c]);
+  }
+
+#if CV_SIMD128
+  v_uint8x16 LowLanes[3];
+  v_uint8x16 RangeLanes[3];
+  v_uint32x4 FactorLanes[3];
+  for (int c = 0; c < 3; ++c)
+  {
+    LowLanes[c] = v_setall_u8(pLow[c]);
+    RangeLanes[c] = v_setall_u8(pRange[c]);
+    FactorLanes[c] = v_setall_u32(Factor[c]);
+  }
+#endif
+
+  for (int y = RowBegin; y < RowBegin + Rows; ++y)
+  {
+    const uchar* p = Image.ptr(y);
+    uchar* pNorm = ImageNorm.ptr(y);
+    size_t x = 0;
+
+#if CV_SIMD128
+    v_uint8x16 Lanes[4];
+
+    for (; x + 16 <= Width; x += 16)
+    {
+      if (Channels == 3)
+      {
+        v_load_deinterleave(p + 3 * x, Lanes[0], Lanes[1], Lanes[2]);
+      }
+      else
+      {
+        v_load_deinterleave(
+          p + 4 * x,
+          Lanes[0],
+          Lanes[1],
+          Lanes[2],
+          Lanes[3]);
+      }
+
+      for (int c = 0; c < 3; ++c)
+      {
+        Lanes[c] = StretchLanes(
+          Lanes[c],
+          LowLanes[c],
+          RangeLanes[c],
+          FactorLanes[c]);
+      }
+
+      if (Channels == 3)
+      {
+        v_store_interleave(pNorm + 3 * x, Lanes[0], Lanes[1], Lanes[2]);
+      }
+      else
+      {
+        v_store_interleave(
+          pNorm + 4 * x,
+          Lanes[0],
+          Lanes[1],
+          Lanes[2],
+          Lanes[3]);
+      }
+    }
+#endif
+
+    for (; x < Width; ++x)
+    {
+      const uchar* pPixel = p + x * Channels;
+      uchar* pPixelNorm = pNorm + x * Channels;
+
+      for (int c = 0; c < 3; ++c)
+      {
+        const unsigned Offset = std::min(
+          (pPixel[c] > pLow[c]) ? (unsigned)(pPixel[c] - pLow[c]) : 0u,
+          (unsigned)pRange[c]);
+
+        pPixelNorm[c] = (uchar)((Offset * Factor[c] + (1 << 15)) >> 16);
+      }
+
+      if (Channels == 4)
+      {
+        pPixelNorm[3] = pPixel[3];
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Parallel body that stretches one row band per stripe
+//-----------------------------------------------------------------------------
+class CChannelStretchBody : public ParallelLoopBody
+{
+  public:
+    CChannelStretchBody(
+      const Mat& Image,
+      Mat& ImageNorm,
+      const uchar* pLow,
+      const uchar* pRange,
+      int BandCount) :
+      mImage(Image),
+      mImageNorm(ImageNorm),
+      mpLow(pLow),
+      mpRange(pRange),
+      mBandCount(BandCount)
+    {
+    }
+
+    virtual void operator()(const Range& Bands) const
+    {
+      for (int b = Bands.start; b < Bands.end; ++b)
+      {
+        ApplyChannelStretchRows(
+          mImage,
+          mImageNorm,
+          mpLow,
+          mpRange,
+          GetBandStart(mImage.rows, mBandCount, b),
+          GetBandStart(mImage.rows, mBandCount, b + 1));
+      }
+    }
+
+  private:
+    const Mat& mImage;
+    Mat& mImageNorm;
+    const uchar* mpLow;
+    const uchar* mpRange;
+    int mBandCount;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void ApplyChannelStretch(
+  const Mat& Image,
+  Mat& ImageNorm,
+  const uchar* pLow,
+  const uchar* pRange,
+  int BandCount)
+{
+  ImageNorm.create(Image.size(), Image.type());
+
+  if (BandCount <= 1)
+  {
+    ApplyChannelStretchRows(Image, ImageNorm, pLow, pRange, 0, Image.rows);
+    return;
+  }
+
+  parallel_for_(
+    Range(0, BandCount),
+    CChannelStretchBody(Image, ImageNorm, pLow, pRange, BandCount),
+    BandCount);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   The first occupied level maps to 0 and the cumulative count above it is
+//   scaled to [0, 255]
+//-----------------------------------------------------------------------------
+void BuildEqualizeLut(const unsigned* Counts, uchar* pLut)
+{
+  uint64 Total = 0;
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Total += Counts[i];
+  }
+
+  int First = 0;
+  while ((First < HIST_LIB_LEVELS - 1) && !Counts[First])
+  {
+    First++;
+  }
+
+  if (Counts[First] == Total)
+  {
+    for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      pLut[i] = (uchar)i;
+    }
+    return;
+  }
+
+  const float Scale = 255.0f / (float)(Total - Counts[First]);
+  uint64 Sum = 0;
+
+  for (int i = 0; i <= First; ++i)
+  {
+    pLut[i] = 0;
+  }
+
+  for (int i = First + 1; i < HIST_LIB_LEVELS; ++i)
+  {
+    Sum += Counts[i];
+    pLut[i] = saturate_cast<uchar>(Sum * Scale);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Clipping and redistribution follow cv::CLAHE: the limit is at least one
+//   pixel, the excess is added to every level in equal parts and what
+//   remains is spread with a fixed step
+//-----------------------------------------------------------------------------
+void BuildClippedEqualizeLut(
+  const unsigned* Counts,
+  double ClipLimit,
+  uchar* pLut)
+{
+  unsigned Hist[HIST_LIB_LEVELS];
+  unsigned Total = 0;
+
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Hist[i] = Counts[i];
+    Total += Counts[i];
+  }
+
+  if (ClipLimit > 0)
+  {
+    const unsigned Limit = std::max(
+      (unsigned)(ClipLimit * Total / HIST_LIB_LEVELS),
+      1u);
+
+    unsigned Clipped = 0;
+    for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      if (Hist[i] > Limit)
+      {
+        Clipped += Hist[i] - Limit;
+        Hist[i] = Limit;
+      }
+    }
+
+    const unsigned Batch = Clipped / HIST_LIB_LEVELS;
+    unsigned Residual = Clipped - Batch * HIST_LIB_LEVELS;
+
+    for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      Hist[i] += Batch;
+    }
+
+    if (Residual)
+    {
+      const unsigned Step = std::max(HIST_LIB_LEVELS / Residual, 1u);
+
+      for (unsigned i = 0; (i < HIST_LIB_LEVELS) && Residual; i += Step)
+      {
+        Hist[i]++;
+        Residual--;
+      }
+    }
+  }
+
+  const float Scale = Total ? 255.0f / (float)Total : 0.0f;
+  unsigned Sum = 0;
+
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Sum += Hist[i];
+    pLut[i] = saturate_cast<uchar>(Sum * Scale);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Parallel body that builds the tables of a range of tiles
+//-----------------------------------------------------------------------------
+class CTileEqualizeBody : public ParallelLoopBody
+{
+  public:
+    CTileEqualizeBody(const unsigned* Counts, double ClipLimit, uchar* pLuts) :
+      mCounts(Counts),
+      mClipLimit(ClipLimit),
+      mpLuts(pLuts)
+    {
+    }
+
+    virtual void operator()(const Range& Tiles) const
+    {
+      for (int t = Tiles.start; t < Tiles.end; ++t)
+      {
+        BuildClippedEqualizeLut(
+          mCounts + t * HIST_LIB_LEVELS,
+          mClipLimit,
+          mpLuts + t * HIST_LIB_LEVELS);
+      }
+    }
+
+  private:
+    const unsigned* mCounts;
+    double mClipLimit;
+    uchar* mpLuts;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void BuildTileEqualizeLuts(
+  const unsigned* Counts,
+  int Tiles,
+  double ClipLimit,
+  unsigned ThreadCount,
+  uchar* pLuts)
+{
+  CTileEqualizeBody Body(Counts, ClipLimit, pLuts);
+  const int StripeCount = GetStripeCount(Tiles, ThreadCount);
+
+  if (StripeCount > 1)
+  {
+    parallel_for_(Range(0, Tiles), Body, StripeCount);
+  }
+  else
+  {
+    Body(Range(0, Tiles));
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Finds, for every position along an axis of Length pixels split into
+//   Tiles tiles, the tile whose centre is at or before the pixel centre and
+//   the weight of the next tile.  Pixels before the first or after the last
+//   centre use that tile alone.
+//-----------------------------------------------------------------------------
+static void GetTileWeights(
+  int Length,
+  int Tiles,
+  int Position,
+  int& Tile,
+  float& Weight)
+{
+  // Tile t is centred on (Start(t) + Start(t + 1)) / 2, in units of half
+  // pixels so everything stays integral
+  const int Centre2 = 2 * Position + 1;
+
+  // Start from an estimate of the tile holding the pixel and correct it
+  Tile = (int)(((int64)Position * Tiles) / Length);
+
+  while ((Tile + 1 < Tiles) &&
+         (GetBandStart(Length, Tiles, Tile + 1) <= Position))
+  {
+    Tile++;
+  }
+
+  while ((Tile > 0) && (GetBandStart(Length, Tiles, Tile) > Position))
+  {
+    Tile--;
+  }
+
+  const int TileCentre2 = GetBandStart(Length, Tiles, Tile)
+    + GetBandStart(Length, Tiles, Tile + 1);
+
+  if (Centre2 < TileCentre2)
+  {
+    Tile--;
+  }
+
+  if (Tile < 0)
+  {
+    Tile = 0;
+    Weight = 0;
+    return;
+  }
+
+  if (Tile >= Tiles - 1)
+  {
+    Tile = Tiles - 1;
+    Weight = 0;
+    return;
+  }
+
+  const int Centre2A = GetBandStart(Length, Tiles, Tile)
+    + GetBandStart(Length, Tiles, Tile + 1);
+  const int Centre2B = GetBandStart(Length, Tiles, Tile + 1)
+    + GetBandStart(Length, Tiles, Tile + 2);
+
+  Weight = (float)(Centre2 - Centre2A) / (float)(Centre2B - Centre2A);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Parallel body of ApplyTileLuts() that handles one row band per stripe
+//-----------------------------------------------------------------------------
+class CTileLutBody : public ParallelLoopBody
+{
+  public:
+    CTileLutBody(
+      const Mat& Image,
+      Mat& ImageEq,
+      const uchar* pLuts,
+      int TilesX,
+      int TilesY,
+      int BandCount,
+      const int* pColTiles,
+      const float* pColWeights) :
+      mImage(Image),
+      mImageEq(ImageEq),
+      mpLuts(pLuts),
+      mTilesX(TilesX),
+      mTilesY(TilesY),
+      mBandCount(BandCount),
+      mpColTiles(pColTiles),
+      mpColWeights(pColWeights)
+    {
+    }
+
+    virtual void operator()(const Range& Bands) const
+    {
+      const int Channels = mImage.channels();
+      const int RowBegin = GetBandStart(mImage.rows, mBandCount, Bands.start);
+      const int RowEnd = GetBandStart(mImage.rows, mBandCount, Bands.end);
+
+      uchar Value[HIST_LIB_VALUE_CHUNK];
+
+      // Reciprocal of every value, 0 keeps black pixels black
+      float Inverse[HIST_LIB_LEVELS];
+      Inverse[0] = 0;
+      for (int v = 1; v < HIST_LIB_LEVELS; ++v)
+      {
+        Inverse[v] = 1.0f / (float)v;
+      }
+
+      for (int y = RowBegin; y < RowEnd; ++y)
+      {
+        int TileY;
+        float WeightY;
+        GetTileWeights(mImage.rows, mTilesY, y, TileY, WeightY);
+
+        const int NextY = std::min(TileY + 1, mTilesY - 1);
+        const uchar* pLutRow0 = mpLuts + TileY * mTilesX * HIST_LIB_LEVELS;
+        const uchar* pLutRow1 = mpLuts + NextY * mTilesX * HIST_LIB_LEVELS;
+
+        const uchar* pRow = mImage.ptr(y);
+        uchar* pRowEq = mImageEq.ptr(y);
+
+        for (int x = 0; x < mImage.cols; x += HIST_LIB_VALUE_CHUNK)
+        {
+          const int Count = std::min(HIST_LIB_VALUE_CHUNK, mImage.cols - x);
+          const uchar* p = pRow + x * Channels;
+          uchar* pEq = pRowEq + x * Channels;
+
+          ComputeValuePixels(p, Value, Count, Channels);
+
+          for (int i = 0; i < Count; ++i, p += Channels, pEq += Channels)
+          {
+            const int V = Value[i];
+            const int Tile0 = mpColTiles[x + i];
+            const int Tile1 = std::min(Tile0 + 1, mTilesX - 1);
+            const float WeightX = mpColWeights[x + i];
+
+            const float Top =
+              pLutRow0[Tile0 * HIST_LIB_LEVELS + V] * (1 - WeightX) +
+              pLutRow0[Tile1 * HIST_LIB_LEVELS + V] * WeightX;
+            const float Bottom =
+              pLutRow1[Tile0 * HIST_LIB_LEVELS + V] * (1 - WeightX) +
+              pLutRow1[Tile1 * HIST_LIB_LEVELS + V] * WeightX;
+
+            // No channel exceeds V, so no result exceeds the new value
+            const float Ratio =
+              (Top * (1 - WeightY) + Bottom * WeightY) * Inverse[V];
+
+            pEq[0] = (uchar)(p[0] * Ratio + 0.5f);
+            pEq[1] = (uchar)(p[1] * Ratio + 0.5f);
+            pEq[2] = (uchar)(p[2] * Ratio + 0.5f);
+
+            if (Channels == 4)
+            {
+              pEq[3] = p[3];
+            }
+          }
+        }
+      }
+    }
+
+  private:
+    const Mat& mImage;
+    Mat& mImageEq;
+    const uchar* mpLuts;
+    int mTilesX;
+    int mTilesY;
+    int mBandCount;
+    const int* mpColTiles;
+    const float* mpColWeights;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void ApplyTileLuts(
+  const Mat& Image,
+  Mat& ImageEq,
+  const uchar* pLuts,
+  int TilesX,
+  int TilesY,
+  int BandCount,
+  std::vector<int>& ColTiles,
+  std::vector<float>& ColWeights)
+{
+  ImageEq.create(Image.size(), Image.type());
+
+  ColTiles.resize(Image.cols);
+  ColWeights.resize(Image.cols);
+
+  for (int x = 0; x < Image.cols; ++x)
+  {
+    GetTileWeights(Image.cols, TilesX, x, ColTiles[x], ColWeights[x]);
+  }
+
+  BandCount = std::max(BandCount, 1);
+
+  CTileLutBody Body(
+    Image,
+    ImageEq,
+    pLuts,
+    TilesX,
+    TilesY,
+    BandCount,
+    &ColTiles[0],
+    &ColWeights[0]);
+
+  if (BandCount == 1)
+  {
+    Body(Range(0, 1));
+  }
+  else
+  {
+    parallel_for_(Range(0, BandCount), Body, BandCount);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Folds 256 levels into 256 >> Shift bins of 1 << Shift levels each
+//-----------------------------------------------------------------------------
+template <unsigned Shift>
+static void FoldShifted(const unsigned* Counts, float* pHist)
+{
+  const unsigned BinCount = HIST_LIB_LEVELS >> Shift;
+
+  for (unsigned Bin = 0; Bin < BinCount; ++Bin)
+  {
+    const unsigned* pLevels = Counts + (Bin << Shift);
+
+    unsigned Sum = 0;
+    for (unsigned i = 0; i < (1u << Shift); ++i)
+    {
+      Sum += pLevels[i];
+    }
+    pHist[Bin] = (float)Sum;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Level i falls into bin floor(i * BinCount / 256), which is exactly the
+//   mapping calcHist uses for a uniform {0, 256} range.  Power of two bin
+//   counts up to 256 (the common 256, 128, 64, 32 and 16) sum runs of
+//   1 << Shift levels with a kernel specialised for the shift.
+//-----------------------------------------------------------------------------
+void FoldBins(const unsigned* Counts, unsigned BinCount, float* pHist)
+{
+  switch (BinCount)
+  {
+    case 256: FoldShifted<0>(Counts, pHist); return;
+    case 128: FoldShifted<1>(Counts, pHist); return;
+    case 64:  FoldShifted<2>(Counts, pHist); return;
+    case 32:  FoldShifted<3>(Counts, pHist); return;
+    case 16:  FoldShifted<4>(Counts, pHist); return;
+    case 8:   FoldShifted<5>(Counts, pHist); return;
+    case 4:   FoldShifted<6>(Counts, pHist); return;
+    case 2:   FoldShifted<7>(Counts, pHist); return;
+    case 1:   FoldShifted<8>(Counts, pHist); return;
+  }
+
+  if (BinCount >= HIST_LIB_LEVELS)
+  {
+    // Every level has a bin of its own, the bins in between stay empty
+    if (BinCount > HIST_LIB_LEVELS)
+    {
+      memset(pHist, 0, BinCount * sizeof(float));
+    }
+
+    for (unsigned i = 0; i < HIST_LIB_LEVELS; ++i)
+    {
+      pHist[(i * BinCount) >> 8] = (float)Counts[i];
+    }
+    return;
+  }
+
+  // Accumulate in integers and convert once so that the result is exact for
+  // every bin that fits in a float
+  unsigned Bins[HIST_LIB_LEVELS];
+  memset(Bins, 0, sizeof(Bins));
+
+  for (unsigned i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Bins[(i * BinCount) >> 8] += Counts[i];
+  }
+
+  for (unsigned i = 0; i < BinCount; ++i)
+  {
+    pHist[i] = (float)Bins[i];
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void FoldHistogram(const unsigned* Counts, unsigned BinCount, MatND& Hist)
+{
+  Hist.create(BinCount, 1, CV_32F);
+
+  FoldBins(Counts, BinCount, Hist.ptr<float>());
+}
@@ -0,0 +1,513 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#ifndef HIST_LIB_KERNELS
+#define HIST_LIB_KERNELS
+
+// Internal counting kernels shared by CHistLib and the helper classes built on
+// top of it.  The 8-bit kernels work on the raw 256 levels of a channel and
+// FoldHistogram() then maps those levels onto the requested number of bins.
+// 16-bit and float images are binned directly by CWideCounter.
+
+// Number of levels in an 8-bit channel
+#define HIST_LIB_LEVELS 256
+
+// Minimum number of rows a parallel band should contain.  Smaller bands cost
+// more in setup and reduction than they save.
+#define HIST_LIB_MIN_BAND_ROWS 64
+
+// Number of interleaved sub-histograms per channel.  Neighbouring pixels are
+// counted into different sub-histograms so that runs of identical values do
+// not stall on a store-to-load dependency through the same counter.
+#define HIST_LIB_SUB_HISTS 4
+
+// Number of pixels whose value channel is computed into a stack buffer before
+// it is counted.  Small enough to stay in L1 next to the sub-histograms.
+#define HIST_LIB_VALUE_CHUNK 1024
+
+// Number of fine bins per coarse block used for wide (16-bit and float)
+// histograms
+#define HIST_LIB_FINE_BLOCK 256
+
+#include "histCumulative.h"
+#include "histMask.h"
+#include "histWorkspace.h"
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts all three channels of an interleaved BGR or BGRA image in a single
+//   pass over the pixels
+//-----------------------------------------------------------------------------
+class CBGRCounter
+{
+  public:
+    CBGRCounter();
+
+    // Resets all counts to zero
+    void Clear();
+
+    // Counts rows [RowBegin, RowEnd) of a CV_8UC3 or CV_8UC4 image
+    void AddRows(const cv::Mat& Image, int RowBegin, int RowEnd);
+
+    // Counts Width pixels that are Channels bytes apart
+    void AddPixels(const uchar* pPixels, size_t Width, int Channels);
+
+    // Adds the merged 256 level counts of each channel to the given arrays
+    void Reduce(unsigned* CountsB, unsigned* CountsG, unsigned* CountsR) const;
+
+  private:
+    unsigned mCounts[3][HIST_LIB_SUB_HISTS][HIST_LIB_LEVELS];
+};
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts a single 8-bit channel, or the value channel (max of B, G and R) of
+//   a BGR/BGRA image without converting the image to HSV first
+//-----------------------------------------------------------------------------
+class CValueCounter
+{
+  public:
+    CValueCounter();
+
+    // Resets all counts to zero
+    void Clear();
+
+    // Counts rows [RowBegin, RowEnd) of a CV_8UC1, CV_8UC3 or CV_8UC4 image
+    void AddRows(const cv::Mat& Image, int RowBegin, int RowEnd);
+
+    // Counts Width consecutive bytes
+    void AddPixels(const uchar* pPixels, size_t Width);
+
+    // Counts Width single channel (Channels = 1) or BGR(A) pixels
+    void AddPixels(const uchar* pPixels, size_t Width, int Channels);
+
+    // Counts the value channel of Width interleaved BGR(A) pixels
+    void AddValuePixels(const uchar* pPixels, size_t Width, int Channels);
+
+    // Adds the merged 256 level counts to the given array
+    void Reduce(unsigned* Counts) const;
+
+  private:
+    unsigned mCounts[HIST_LIB_SUB_HISTS][HIST_LIB_LEVELS];
+};
+
+// Writes max(B, G, R) of Width interleaved BGR(A) pixels to pValue
+void ComputeValuePixels(
+  const uchar* pPixels,
+  uchar* pValue,
+  size_t Width,
+  int Channels);
+
+// Counts only the pixels of a CV_8UC3/CV_8UC4 image whose mask is set, using
+// BandCount row bands in parallel.  Exactly one of pMask (CV_8UC1, non-zero
+// means set) and pPackedMask must be given.
+void CountBGRMasked(
+  const cv::Mat& Image,
+  const cv::Mat* pMask,
+  const CHistPackedMask* pPackedMask,
+  int BandCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR);
+
+// Same as CountBGRMasked for a CV_8UC1 image or the value channel of a
+// CV_8UC3/CV_8UC4 image
+void CountValueMasked(
+  const cv::Mat& Image,
+  const cv::Mat* pMask,
+  const CHistPackedMask* pPackedMask,
+  int BandCount,
+  unsigned* Counts);
+
+// Counts a subset of the pixels of a CV_8UC1, CV_8UC3 or CV_8UC4 image.  With
+// Random false the pixels lie on a lattice of about Fraction of the pixels
+// (a whole row step of at most 1 / sqrt(Fraction) and a fractional column
+// step), otherwise each pixel is picked with probability Fraction by an RNG
+// seeded with Seed.  Returns the number of pixels counted (0 for an empty
+// image or a Fraction of 0 or less).
+size_t SampleValue(
+  const cv::Mat& Image,
+  bool Random,
+  double Fraction,
+  unsigned Seed,
+  CValueCounter& Counter);
+
+// Same as SampleValue for the three channels of a CV_8UC3/CV_8UC4 image
+size_t SampleBGR(
+  const cv::Mat& Image,
+  bool Random,
+  double Fraction,
+  unsigned Seed,
+  CBGRCounter& Counter);
+
+// Returns the number of row bands an image should be split into when up to
+// ThreadCount threads are allowed (0 means as many as OpenCV uses)
+int GetBandCount(const cv::Mat& Image, unsigned ThreadCount);
+
+// Returns the number of stripes Jobs independent jobs should be split into
+// when up to ThreadCount threads are allowed (0 means as many as OpenCV uses)
+int GetStripeCount(int Jobs, unsigned ThreadCount);
+
+// Returns the first row of band Band when Rows are split into BandCount bands
+int GetBandStart(int Rows, int BandCount, int Band);
+
+// Counts a CV_8UC3/CV_8UC4 image using BandCount row bands in parallel.  Each
+// band has a private counter and the bands are reduced in order, so the
+// result is identical to the serial count.  The band counters are kept in
+// pScratch when given, otherwise they are allocated for the call.
+void CountBGR(
+  const cv::Mat& Image,
+  int BandCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR,
+  std::vector<CBGRCounter>* pScratch = 0);
+
+// Counts a CV_8UC1 image, or the value channel of a CV_8UC3/CV_8UC4 image,
+// using BandCount row bands in parallel
+void CountValue(
+  const cv::Mat& Image,
+  int BandCount,
+  unsigned* Counts,
+  std::vector<CValueCounter>* pScratch = 0);
+
+// Counts the single channel, or the value channel, of every tile of a
+// TilesX x TilesY grid in one pass.  Counts holds 256 levels per tile with the
+// tiles in row-major order.  Tile boundaries follow GetBandStart().  Rows of
+// tiles are counted in parallel on up to ThreadCount threads.
+void CountValueTiles(
+  const cv::Mat& Image,
+  int TilesX,
+  int TilesY,
+  unsigned ThreadCount,
+  unsigned* Counts);
+
+// Counts the three channels of every tile of a CV_8UC3/CV_8UC4 image
+void CountBGRTiles(
+  const cv::Mat& Image,
+  int TilesX,
+  int TilesY,
+  unsigned ThreadCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR);
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Location of the planes of a YUV 4:2:0 frame.  Chroma sample x of chroma
+//   row c is at pU[c * UVStep + x * UVPixelStep] (likewise for pV), which
+//   covers both the planar and the interleaved (semi-planar) layouts.
+//-----------------------------------------------------------------------------
+struct CYUVPlanes
+{
+  const uchar* pY;
+  size_t YStep;
+  const uchar* pU;
+  const uchar* pV;
+  size_t UVStep;
+  int UVPixelStep;
+  int Width;
+  int Height;
+};
+
+// Converts Count pixels of luma row Row, starting at the even column x, to
+// interleaved BGR with the BT.601 fixed point coefficients cvtColor uses for
+// its YUV 4:2:0 conversions
+void ConvertYUVPixels(
+  const CYUVPlanes& Planes,
+  int Row,
+  int x,
+  int Count,
+  uchar* pBGR);
+
+// Counts the BGR histograms of a YUV 4:2:0 frame without converting the
+// frame, using BandCount row bands in parallel
+void CountYUVBGR(
+  const CYUVPlanes& Planes,
+  int BandCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR);
+
+// Counts the value (max of B, G and R) histogram of a YUV 4:2:0 frame
+void CountYUVValue(const CYUVPlanes& Planes, int BandCount, unsigned* Counts);
+
+// Counts the subsampled U and V planes of a YUV 4:2:0 frame
+void CountYUVChroma(
+  const CYUVPlanes& Planes,
+  unsigned* CountsU,
+  unsigned* CountsV);
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts an 8-bit image (value or BGR) into 16-bit sub-histograms, which
+//   halves the working set of CBGRCounter/CValueCounter and keeps it in L1.
+//   The sub-histograms are promoted into 64-bit totals at the latest every
+//   USHRT_MAX pixels, before any counter can overflow, so the totals are exact
+//   for images of any size.
+//-----------------------------------------------------------------------------
+class CCompactCounter
+{
+  public:
+    // IsBGR selects three channel histograms, otherwise the single channel
+    // (or the value channel of a BGR/BGRA image) is counted
+    CCompactCounter(bool IsBGR);
+
+    // Counts rows [RowBegin, RowEnd) of a CV_8UC1, CV_8UC3 or CV_8UC4 image
+    void AddRows(const cv::Mat& Image, int RowBegin, int RowEnd);
+
+    // Adds the 256 level totals of each histogram to the given arrays (only
+    // CountsB is used for a single channel histogram)
+    void Reduce(uint64* CountsB, uint64* CountsG, uint64* CountsR);
+
+  private:
+    void AddPixels(const uchar* p, size_t Width, int Channels);
+    void AddValues(const uchar* p, size_t Width);
+    void Flush();
+
+    bool mIsBGR;
+
+    // Pixels added since the last flush
+    unsigned mPending;
+
+    unsigned short mCounts[3][HIST_LIB_SUB_HISTS][HIST_LIB_LEVELS];
+    uint64 mTotals[3][HIST_LIB_LEVELS];
+};
+
+// Counts an 8-bit image into exact 64-bit totals using BandCount row bands in
+// parallel (CountsG and CountsR are only used when IsBGR is set).  The band
+// counters are kept in pScratch when given.
+void CountCompact(
+  const cv::Mat& Image,
+  bool IsBGR,
+  int BandCount,
+  uint64* CountsB,
+  uint64* CountsG,
+  uint64* CountsR,
+  std::vector<CCompactCounter>* pScratch = 0);
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts CV_16U or CV_32F images into up to HIST_LIB_MAX_BINS uniform bins
+//   over [Low, High); values outside the range are ignored.  Counting uses a
+//   two level scheme: 16-bit fine counters grouped into coarse blocks of
+//   HIST_LIB_FINE_BLOCK bins.  Each block tracks how many samples it received
+//   and is flushed into 32-bit totals before any of its fine counters can
+//   overflow, which halves the working set of the hot counters.
+//-----------------------------------------------------------------------------
+class CWideCounter
+{
+  public:
+    CWideCounter();
+
+    // Clears the counters and sets up BinCount bins over [Low, High).  IsBGR
+    // selects three channel histograms, otherwise the single channel (or the
+    // maximum over the channels) is counted.  The storage of earlier calls is
+    // reused.
+    void Reset(unsigned BinCount, double Low, double High, bool IsBGR);
+
+    // Counts rows [RowBegin, RowEnd) of a 1, 3 or 4 channel CV_16U/CV_32F image
+    void AddRows(const cv::Mat& Image, int RowBegin, int RowEnd);
+
+    // Flushes the fine counters and adds BinCount totals per histogram to the
+    // given arrays (only CountsB is used for a single channel histogram)
+    void Reduce(unsigned* CountsB, unsigned* CountsG, unsigned* CountsR);
+
+  private:
+    template <typename T>
+    void AddRowsOfType(const cv::Mat& Image, int RowBegin, int RowEnd);
+
+    template <unsigned Shift>
+    void AddRowsShifted(const cv::Mat& Image, int RowBegin, int RowEnd);
+
+    inline void Add(unsigned Hist, double Value);
+    inline void AddBin(unsigned Hist, unsigned Bin);
+    void FlushBlock(unsigned Block);
+
+    unsigned mBinCount;
+    unsigned mBlockCount;
+    unsigned mHistCount;
+    double mLow;
+    double mScale;
+
+    // When every bin covers a power of two of 16-bit values starting at an
+    // integer Low, the bin of a 16-bit value is (Value - Low) >> mShift.
+    // Otherwise mShift is -1 and the bins are found in floating point.
+    int mShift;
+    unsigned mLowValue;
+
+    // mHistCount * mBinCount fine counters and totals
+    std::vector<unsigned short> mFine;
+    std::vector<unsigned> mTotals;
+
+    // mHistCount * mBlockCount samples added since each block was flushed
+    std::vector<unsigned short> mCoarse;
+};
+
+// Counts a CV_16U/CV_32F image using BandCount row bands in parallel.  The
+// count arrays must hold BinCount entries (CountsG/CountsR only for BGR).
+// The band counters are kept in pScratch when given, otherwise they are
+// allocated for the call.
+void CountWide(
+  const cv::Mat& Image,
+  unsigned BinCount,
+  double Low,
+  double High,
+  bool IsBGR,
+  int BandCount,
+  unsigned* CountsB,
+  unsigned* CountsG,
+  unsigned* CountsR,
+  std::vector<CWideCounter>* pScratch = 0);
+
+// Builds the 256 entry table of the value stretch (v - Min) * Scale, clipped
+// to [0, 255] and rounded with cvRound
+void BuildStretchLut(double Min, double Scale, uchar* pLut);
+
+// Returns the 16.16 fixed point factor 255 / Range (Range in [1, 255])
+unsigned GetStretchFactor(unsigned Range);
+
+// Builds the 256 entry table of the fixed point stretch of [Low, Low + Range]
+// onto [0, 255]: (min(max(v - Low, 0), Range) * GetStretchFactor(Range) +
+// 2^15) >> 16.  It is at most 0.5 off the exact stretch and only differs from
+// BuildStretchLut on exact ties (which cvRound rounds to even).  A Range of 0
+// maps levels above Low to 255 and the others to 0, as BuildStretchLut does.
+void BuildFixedStretchLut(unsigned Low, unsigned Range, uchar* pLut);
+
+// Stretches B, G and R of a CV_8UC3/CV_8UC4 image separately with the fixed
+// point formula of BuildFixedStretchLut (pLow and pRange hold one entry per
+// channel, every Range at least 1), using BandCount row bands in parallel.
+// Alpha is copied.
+void ApplyChannelStretch(
+  const cv::Mat& Image,
+  cv::Mat& ImageNorm,
+  const uchar* pLow,
+  const uchar* pRange,
+  int BandCount);
+
+// Builds the 16.16 fixed point factors Stretch[V] / V that map a pixel with
+// value V onto value Stretch[V]
+void BuildValueScales(const uchar* pStretch, unsigned* pScales);
+
+// Rescales B, G and R of every pixel of a CV_8UC3/CV_8UC4 image by the factor
+// of its value, max(B, G, R), using BandCount row bands in parallel.  Hue and
+// saturation are kept.
+void ApplyValueScales(
+  const cv::Mat& Image,
+  cv::Mat& ImageNorm,
+  const unsigned* pScales,
+  int BandCount);
+
+// Builds the histogram equalization table of 256 level counts the way
+// cv::equalizeHist does.  An image with a single value maps to itself.
+void BuildEqualizeLut(const unsigned* Counts, uchar* pLut);
+
+// Builds the CLAHE table of one tile: bins above ClipLimit times the mean
+// bin count are clipped, the excess is spread evenly over all levels and the
+// cumulative counts are scaled to [0, 255].  A ClipLimit of 0 or less
+// disables clipping.
+void BuildClippedEqualizeLut(
+  const unsigned* Counts,
+  double ClipLimit,
+  uchar* pLut);
+
+// Builds the CLAHE tables of Tiles tiles (256 counts and 256 table entries
+// per tile), in parallel on up to ThreadCount threads
+void BuildTileEqualizeLuts(
+  const unsigned* Counts,
+  int Tiles,
+  double ClipLimit,
+  unsigned ThreadCount,
+  uchar* pLuts);
+
+// Equalizes the value channel of a CV_8UC3/CV_8UC4 image with one table per
+// tile of a TilesX x TilesY grid (256 entries per tile, row-major).  The new
+// value of a pixel is interpolated bilinearly between the tables of the four
+// nearest tile centres and B, G and R are rescaled by newV / V, in a single
+// pass over BandCount row bands.  ColTiles and ColWeights are scratch.
+void ApplyTileLuts(
+  const cv::Mat& Image,
+  cv::Mat& ImageEq,
+  const uchar* pLuts,
+  int TilesX,
+  int TilesY,
+  int BandCount,
+  std::vector<int>& ColTiles,
+  std::vector<float>& ColWeights);
+
+// Maps 256 level counts onto BinCount uniform bins over [0, 256)
+void FoldBins(const unsigned* Counts, unsigned BinCount, float* pHist);
+
+// Same as FoldBins but stores the result as a BinCount x 1 CV_32F histogram
+// (the same layout calcHist produces)
+void FoldHistogram(const unsigned* Counts, unsigned BinCount, cv::MatND& Hist);
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Contents of a CHistWorkspace
+//-----------------------------------------------------------------------------
+struct CHistWorkspace::CBuffers
+{
+  // Per band counters for parallel counting
+  std::vector<CBGRCounter> BGRCounters;
+  std::vector<CValueCounter> ValueCounters;
+  std::vector<CCompactCounter> CompactCounters;
+  std::vector<CWideCounter> WideCounters;
+
+  // Bins of the exact counts of 16-bit and float images
+  std::vector<unsigned> WideCounts[3];
+
+  // Colour layer used to draw BGR histograms
+  cv::Mat Layer;
+
+  // Interleaved per channel table used by the per channel normalization
+  cv::Mat ChannelLut;
+
+  // Tile histograms, tables and column interpolation used by equalization
+  std::vector<unsigned> TileCounts;
+  std::vector<uchar> TileLuts;
+  std::vector<int> ColTiles;
+  std::vector<float> ColWeights;
+
+  // Prefix sums used to find the clip points of the normalizations
+  CCumulativeHist ValueCumulative;
+
+  // Merged histograms used to draw wide histograms
+  cv::MatND Reduced[3];
+
+  // Histograms used by the compute and draw functions
+  cv::MatND Hists[3];
+};
+
+#endif //end #ifndef HIST_LIB_KERNELS
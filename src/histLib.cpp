@@ -31,8 +31,10 @@
 //=============================================================================
 
 #include "histLib.h"
+#include "histKernels.h"
 #include <opencv2/imgproc.hpp>
 #include <iostream>
+#include <limits>
 using namespace cv;
 using namespace std;
 
@@ -47,7 +49,14 @@ CHistLib::CHistLib() :
   mHistBackgroundColor(HIST_LIB_COLOR_BLACK),
   mDrawXAxis(true),
   mSpread(1),
-  mDrawSpreadOut(false)
+  mDrawSpreadOut(false),
+  mThreadCount(1),
+  mSampling(HIST_LIB_SAMPLE_ALL),
+  mSampleFraction(1.0),
+  mSampleSeed(0),
+  mRangeLow(0),
+  mRangeHigh(0),
+  mNormalizeFixedPoint(false)
 {
 }
 
@@ -71,7 +80,7 @@ void CHistLib::SetHistImageHeight(unsigned HistImageHeight)
 //-----------------------------------------------------------------------------
 void CHistLib::SetBinCount(unsigned BinCount)
 {
-  if ((BinCount > 0) && (BinCount <= 256))
+  if ((BinCount > 0) && (BinCount <= HIST_LIB_MAX_BINS))
   {
     mBinCount = BinCount;
   }
@@ -113,6 +122,84 @@ void CHistLib::SetDrawSpreadOut(bool DrawSpreadOut)
   }
 }
 
+//-----------------------------------------------------------------------------
+// Description:
+//   Sets the maximum number of threads used to compute histograms.  1 (the
+//   default) keeps everything on the calling thread and 0 uses as many threads
+//   as OpenCV is configured for.  Results do not depend on this setting.
+//-----------------------------------------------------------------------------
+void CHistLib::SetThreadCount(unsigned ThreadCount)
+{
+  mThreadCount = ThreadCount;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Selects which pixels are counted.  With sampling enabled the histograms
+//   are rescaled to the full pixel count, so they keep the same format.  Only
+//   8-bit images are sampled, 16-bit and float images are counted exactly.
+//-----------------------------------------------------------------------------
+void CHistLib::SetSampling(EHistSampling Sampling)
+{
+  mSampling = Sampling;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Approximate fraction of the pixels that are counted when sampling
+//-----------------------------------------------------------------------------
+void CHistLib::SetSampleFraction(double SampleFraction)
+{
+  if ((SampleFraction > 0) && (SampleFraction <= 1))
+  {
+    mSampleFraction = SampleFraction;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Seed for HIST_LIB_SAMPLE_RANDOM.  The same seed selects the same pixels.
+//-----------------------------------------------------------------------------
+void CHistLib::SetSampleSeed(unsigned SampleSeed)
+{
+  mSampleSeed = SampleSeed;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Sets the value range [Low, High) covered by the bins of 16-bit and float
+//   histograms.  8-bit histograms always cover {0, 256}.  Passing Low >= High
+//   restores the defaults: {0, 65536} for CV_16U and {0, 1} for CV_32F.
+//-----------------------------------------------------------------------------
+void CHistLib::SetHistRange(double Low, double High)
+{
+  if (Low < High)
+  {
+    mRangeLow = Low;
+    mRangeHigh = High;
+  }
+  else
+  {
+    mRangeLow = 0;
+    mRangeHigh = 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Selects integer only stretch arithmetic for the normalization functions.
+//   Every stretched level is within 0.5 of the exact stretch and differs from
+//   the default (floating point, cvRound) output only where the exact value
+//   is a tie, by 1.  The per channel normalization then runs as 8 and 32-bit
+//   SIMD arithmetic instead of a table lookup.  The value normalizations
+//   rescale pixels with 16.16 factors in 32-bit SIMD lanes in both modes;
+//   this mode makes the table those factors come from integer as well.
+//-----------------------------------------------------------------------------
+void CHistLib::SetNormalizeFixedPoint(bool NormalizeFixedPoint)
+{
+  mNormalizeFixedPoint = NormalizeFixedPoint;
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 unsigned CHistLib::GetHistImageHeight() const
@@ -155,11 +242,87 @@ bool CHistLib::GetDrawSpreadOut() const
   return mDrawSpreadOut;
 }
 
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistLib::GetThreadCount() const
+{
+  return mThreadCount;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+EHistSampling CHistLib::GetSampling() const
+{
+  return mSampling;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+double CHistLib::GetSampleFraction() const
+{
+  return mSampleFraction;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistLib::GetSampleSeed() const
+{
+  return mSampleSeed;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Range covered by the bins of an image of the given depth
+//-----------------------------------------------------------------------------
+void CHistLib::GetHistRange(int Depth, double& Low, double& High) const
+{
+  if (Depth == CV_8U)
+  {
+    Low = 0;
+    High = 256;
+  }
+  else if (mRangeLow < mRangeHigh)
+  {
+    Low = mRangeLow;
+    High = mRangeHigh;
+  }
+  else if (Depth == CV_16U)
+  {
+    Low = 0;
+    High = 65536;
+  }
+  else
+  {
+    Low = 0;
+    High = 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool CHistLib::GetNormalizeFixedPoint() const
+{
+  return mNormalizeFixedPoint;
+}
+
 //-----------------------------------------------------------------------------
 // Description:
 //   General purpose histogram drawing function
 //-----------------------------------------------------------------------------
 void CHistLib::DrawHistogram(const Mat& Hist, Mat& HistImage)
+{
+  DrawHistogram(Hist, HistImage, (unsigned)max(Hist.rows, Hist.cols) - 1);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   General purpose histogram drawing function that labels the last bin of
+//   the x axis with LastBin
+//-----------------------------------------------------------------------------
+void CHistLib::DrawHistogram(
+  const Mat& Hist,
+  Mat& HistImage,
+  unsigned LastBin)
 {
   unsigned HistLength;
 
@@ -193,7 +356,7 @@ void CHistLib::DrawHistogram(const Mat& Hist, Mat& HistImage)
 
   if (mDrawXAxis)
   {
-    DrawHistBar(HistImage, HistLength);
+    DrawHistBar(HistImage, HistLength, LastBin);
   }
 }
 
@@ -207,117 +370,969 @@ void CHistLib::ComputeHistogramBGR(
   cv::MatND& HistG,
   cv::MatND& HistR)
 {
-  const Mat* pImageBGR;
-  Mat ImageBGR;
+  ComputeBGR(Image, HistB, HistG, HistR, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a three channel (BGR) histogram with per bin error estimates
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramBGR(
+  const cv::Mat& Image,
+  cv::MatND& HistB,
+  cv::MatND& HistG,
+  cv::MatND& HistR,
+  cv::MatND& HistErrorB,
+  cv::MatND& HistErrorG,
+  cv::MatND& HistErrorR)
+{
+  MatND* HistErrors[] = {&HistErrorB, &HistErrorG, &HistErrorR};
+
+  ComputeBGR(Image, HistB, HistG, HistR, HistErrors, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a three channel (BGR) histogram reusing the band counters of
+//   Workspace
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramBGR(
+  const cv::Mat& Image,
+  cv::MatND& HistB,
+  cv::MatND& HistG,
+  cv::MatND& HistR,
+  CHistWorkspace& Workspace)
+{
+  ComputeBGR(Image, HistB, HistG, HistR, 0, &Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a single channel (Value) histogram
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramValue(const cv::Mat& Image, cv::MatND& Hist)
+{
+  ComputeValue(Image, Hist, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a single channel (Value) histogram reusing the band counters of
+//   Workspace
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramValue(
+  const cv::Mat& Image,
+  cv::MatND& Hist,
+  CHistWorkspace& Workspace)
+{
+  ComputeValue(Image, Hist, 0, &Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a single channel (Value) histogram with per bin error estimates
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramValue(
+  const cv::Mat& Image,
+  cv::MatND& Hist,
+  cv::MatND& HistError)
+{
+  ComputeValue(Image, Hist, &HistError, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Helper that computes a BGR histogram, optionally with error estimates
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeBGR(
+  const cv::Mat& Image,
+  cv::MatND& HistB,
+  cv::MatND& HistG,
+  cv::MatND& HistR,
+  cv::MatND** ppHistError,
+  CHistWorkspace* pWorkspace)
+{
+  MatND* HistErrors[] = {0, 0, 0};
+  if (ppHistError)
+  {
+    HistErrors[0] = ppHistError[0];
+    HistErrors[1] = ppHistError[1];
+    HistErrors[2] = ppHistError[2];
+  }
 
   switch (Image.type())
   {
     case CV_8UC3:
-      pImageBGR = &Image;
+    case CV_8UC4:
     break;
 
-    case CV_8UC4:
+    case CV_16UC3:
+    case CV_32FC3:
     {
-      cvtColor(Image, ImageBGR, CV_RGBA2RGB);
-      pImageBGR = &ImageBGR;
+      ComputeWide(Image, true, HistB, &HistG, &HistR, pWorkspace);
+
+      // Every pixel is counted, this only sets up zero error estimates
+      const double Total = (double)Image.total();
+      ScaleSampledHistogram(HistB, Total, Total, HistErrors[0]);
+      ScaleSampledHistogram(HistG, Total, Total, HistErrors[1]);
+      ScaleSampledHistogram(HistR, Total, Total, HistErrors[2]);
+      return;
     }
+
+    default:
+      CV_Error(CV_StsUnsupportedFormat, "CHistLib::ComputeHistogramBGR");
     break;
+  }
+
+  // Count all three channels in a single pass over the image (the alpha
+  // channel of a BGRA image is simply skipped)
+  unsigned CountsB[HIST_LIB_LEVELS] = {0};
+  unsigned CountsG[HIST_LIB_LEVELS] = {0};
+  unsigned CountsR[HIST_LIB_LEVELS] = {0};
+
+  const double Total = (double)Image.total();
+  double Sampled = Total;
+
+  if (IsSampling())
+  {
+    CBGRCounter Counter;
+    Sampled = (double)SampleBGR(
+      Image,
+      mSampling == HIST_LIB_SAMPLE_RANDOM,
+      mSampleFraction,
+      mSampleSeed,
+      Counter);
+    Counter.Reduce(CountsB, CountsG, CountsR);
+  }
+  else
+  {
+    CountBGR(
+      Image,
+      GetBandCount(Image, mThreadCount),
+      CountsB,
+      CountsG,
+      CountsR,
+      pWorkspace ? &pWorkspace->mpBuffers->BGRCounters : 0);
+  }
+
+  FoldHistogram(CountsB, mBinCount, HistB);
+  FoldHistogram(CountsG, mBinCount, HistG);
+  FoldHistogram(CountsR, mBinCount, HistR);
+
+  ScaleSampledHistogram(HistB, Sampled, Total, HistErrors[0]);
+  ScaleSampledHistogram(HistG, Sampled, Total, HistErrors[1]);
+  ScaleSampledHistogram(HistR, Sampled, Total, HistErrors[2]);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Helper that computes a value histogram, optionally with error estimates
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeValue(
+  const cv::Mat& Image,
+  cv::MatND& Hist,
+  cv::MatND* pHistError,
+  CHistWorkspace* pWorkspace)
+{
+  switch (Image.type())
+  {
+    case CV_8UC1:
+    case CV_8UC3:
+    case CV_8UC4:
+    break;
+
+    case CV_16UC1:
+    case CV_16UC3:
+    case CV_32FC1:
+    case CV_32FC3:
+    {
+      const double Total = (double)Image.total();
+
+      ComputeWide(Image, false, Hist, 0, 0, pWorkspace);
+      ScaleSampledHistogram(Hist, Total, Total, pHistError);
+      return;
+    }
 
     default:
-      CV_Error(CV_StsUnsupportedFormat, "CHistLib::DrawHistogramGray");
+      CV_Error(CV_StsUnsupportedFormat, "CHistLib::ComputeHistogramValue");
     break;
   }
 
-  // Initialize histogram settings
-  int histSize[] = {mBinCount};
-  float Range[] = {0, 256}; //{0, 256} = 0 to 255
-  const float* Ranges[] = {Range};
-  int chanB[] = {0};
-  int chanG[] = {1};
-  int chanR[] = {2};
+  // The value channel is max(B, G, R), so it is computed and counted on the
+  // fly without an HSV conversion or any full size temporaries
+  unsigned Counts[HIST_LIB_LEVELS] = {0};
+
+  const double Total = (double)Image.total();
+  double Sampled = Total;
+
+  if (IsSampling())
+  {
+    CValueCounter Counter;
+    Sampled = (double)SampleValue(
+      Image,
+      mSampling == HIST_LIB_SAMPLE_RANDOM,
+      mSampleFraction,
+      mSampleSeed,
+      Counter);
+    Counter.Reduce(Counts);
+  }
+  else
+  {
+    CountValue(
+      Image,
+      GetBandCount(Image, mThreadCount),
+      Counts,
+      pWorkspace ? &pWorkspace->mpBuffers->ValueCounters : 0);
+  }
+
+  FoldHistogram(Counts, mBinCount, Hist);
 
-  calcHist(pImageBGR, 1, chanB, Mat(), // do not use mask
-    HistB,
-    1,
-    histSize,
-    Ranges,
-    true, // the histogram is uniform
-    false);
+  ScaleSampledHistogram(Hist, Sampled, Total, pHistError);
+}
 
-  calcHist(pImageBGR, 1, chanG, Mat(), // do not use mask
-    HistG,
-    1,
-    histSize,
-    Ranges,
-    true, // the histogram is uniform
-    false);
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a three channel (BGR) histogram of the pixels selected by an
+//   8-bit mask
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramBGRMasked(
+  const cv::Mat& Image,
+  const cv::Mat& Mask,
+  cv::MatND& HistB,
+  cv::MatND& HistG,
+  cv::MatND& HistR)
+{
+  ComputeBGRMasked(Image, &Mask, 0, HistB, HistG, HistR);
+}
 
-  calcHist(pImageBGR, 1, chanR, Mat(), // do not use mask
-    HistR,
-    1,
-    histSize,
-    Ranges,
-    true, // the histogram is uniform
-    false);
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a three channel (BGR) histogram of the pixels selected by a
+//   packed 1-bit mask
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramBGRMasked(
+  const cv::Mat& Image,
+  const CHistPackedMask& Mask,
+  cv::MatND& HistB,
+  cv::MatND& HistG,
+  cv::MatND& HistR)
+{
+  ComputeBGRMasked(Image, 0, &Mask, HistB, HistG, HistR);
 }
 
 //-----------------------------------------------------------------------------
 // Description:
-//   Computes a single channel (Value) histogram
+//   Computes a single channel (value) histogram of the pixels selected by an
+//   8-bit mask
 //-----------------------------------------------------------------------------
-void CHistLib::ComputeHistogramValue(const cv::Mat& Image, cv::MatND& Hist)
+void CHistLib::ComputeHistogramValueMasked(
+  const cv::Mat& Image,
+  const cv::Mat& Mask,
+  cv::MatND& Hist)
 {
-  // Create 1 channel image to get a value representation
-  Mat ImageValue = Mat(Image.size(), CV_8UC1);
+  ComputeValueMasked(Image, &Mask, 0, Hist);
+}
 
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a single channel (value) histogram of the pixels selected by a
+//   packed 1-bit mask
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramValueMasked(
+  const cv::Mat& Image,
+  const CHistPackedMask& Mask,
+  cv::MatND& Hist)
+{
+  ComputeValueMasked(Image, 0, &Mask, Hist);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Helper for the masked BGR histograms.  Sampling does not apply to masked
+//   histograms, every selected pixel is counted.
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeBGRMasked(
+  const cv::Mat& Image,
+  const cv::Mat* pMask,
+  const CHistPackedMask* pPackedMask,
+  cv::MatND& HistB,
+  cv::MatND& HistG,
+  cv::MatND& HistR)
+{
   switch (Image.type())
   {
-    case CV_8UC1:
-      Image.copyTo(ImageValue);
+    case CV_8UC3:
+    case CV_8UC4:
+    break;
+
+    default:
+      CV_Error(CV_StsUnsupportedFormat, "CHistLib::ComputeHistogramBGRMasked");
     break;
+  }
+
+  unsigned CountsB[HIST_LIB_LEVELS] = {0};
+  unsigned CountsG[HIST_LIB_LEVELS] = {0};
+  unsigned CountsR[HIST_LIB_LEVELS] = {0};
+
+  CountBGRMasked(
+    Image,
+    pMask,
+    pPackedMask,
+    GetBandCount(Image, mThreadCount),
+    CountsB,
+    CountsG,
+    CountsR);
+
+  FoldHistogram(CountsB, mBinCount, HistB);
+  FoldHistogram(CountsG, mBinCount, HistG);
+  FoldHistogram(CountsR, mBinCount, HistR);
+}
 
+//-----------------------------------------------------------------------------
+// Description:
+//   Helper for the masked value histograms
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeValueMasked(
+  const cv::Mat& Image,
+  const cv::Mat* pMask,
+  const CHistPackedMask* pPackedMask,
+  cv::MatND& Hist)
+{
+  switch (Image.type())
+  {
+    case CV_8UC1:
     case CV_8UC3:
+    case CV_8UC4:
+    break;
+
+    default:
+      CV_Error(CV_StsUnsupportedFormat, "CHistLib::ComputeHistogramValueMasked");
+    break;
+  }
+
+  unsigned Counts[HIST_LIB_LEVELS] = {0};
+
+  CountValueMasked(
+    Image,
+    pMask,
+    pPackedMask,
+    GetBandCount(Image, mThreadCount),
+    Counts);
+
+  FoldHistogram(Counts, mBinCount, Hist);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Helper for 16-bit and float images.  Every pixel is counted (sampling
+//   only applies to 8-bit images) straight into mBinCount bins.  The bins and
+//   band counters live in pWorkspace when given.
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeWide(
+  const cv::Mat& Image,
+  bool IsBGR,
+  cv::MatND& HistB,
+  cv::MatND* pHistG,
+  cv::MatND* pHistR,
+  CHistWorkspace* pWorkspace)
+{
+  // The wide kernels keep 32-bit totals
+  if ((uint64)Image.total() > (uint64)UINT_MAX)
+  {
+    CV_Error(CV_StsOutOfRange, "CHistLib::ComputeWide");
+  }
+
+  double Low;
+  double High;
+  GetHistRange(Image.depth(), Low, High);
+
+  const int HistCount = IsBGR ? 3 : 1;
+  vector<unsigned> LocalCounts[3];
+  vector<unsigned>* Counts =
+    pWorkspace ? pWorkspace->mpBuffers->WideCounts : LocalCounts;
+
+  for (int c = 0; c < HistCount; ++c)
+  {
+    Counts[c].assign(mBinCount, 0);
+  }
+
+  CountWide(
+    Image,
+    mBinCount,
+    Low,
+    High,
+    IsBGR,
+    GetBandCount(Image, mThreadCount),
+    &Counts[0][0],
+    IsBGR ? &Counts[1][0] : 0,
+    IsBGR ? &Counts[2][0] : 0,
+    pWorkspace ? &pWorkspace->mpBuffers->WideCounters : 0);
+
+  MatND* Hists[] = {&HistB, pHistG, pHistR};
+
+  for (int c = 0; c < HistCount; ++c)
+  {
+    Hists[c]->create(mBinCount, 1, CV_32F);
+    float* pHist = Hists[c]->ptr<float>();
+
+    for (unsigned i = 0; i < mBinCount; ++i)
+    {
+      pHist[i] = (float)Counts[c][i];
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a histogram of the luma plane.  The plane is counted like any
+//   single channel image, so sampling and threading apply as usual.
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramLumaYUV(
+  const cv::Mat& Image,
+  EHistYUVLayout Layout,
+  cv::MatND& Hist)
+{
+  const CYUVPlanes Planes = GetYUVPlanes(Image, Layout);
+
+  ComputeValue(Image.rowRange(0, Planes.Height), Hist, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes histograms of the U and V planes
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramChromaYUV(
+  const cv::Mat& Image,
+  EHistYUVLayout Layout,
+  cv::MatND& HistU,
+  cv::MatND& HistV)
+{
+  const CYUVPlanes Planes = GetYUVPlanes(Image, Layout);
+
+  unsigned CountsU[HIST_LIB_LEVELS] = {0};
+  unsigned CountsV[HIST_LIB_LEVELS] = {0};
+
+  CountYUVChroma(Planes, CountsU, CountsV);
+
+  FoldHistogram(CountsU, mBinCount, HistU);
+  FoldHistogram(CountsV, mBinCount, HistV);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a BGR histogram of a YUV frame.  Every pixel is counted.
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramBGRYUV(
+  const cv::Mat& Image,
+  EHistYUVLayout Layout,
+  cv::MatND& HistB,
+  cv::MatND& HistG,
+  cv::MatND& HistR)
+{
+  const CYUVPlanes Planes = GetYUVPlanes(Image, Layout);
+
+  unsigned CountsB[HIST_LIB_LEVELS] = {0};
+  unsigned CountsG[HIST_LIB_LEVELS] = {0};
+  unsigned CountsR[HIST_LIB_LEVELS] = {0};
+
+  CountYUVBGR(
+    Planes,
+    GetBandCount(Image.rowRange(0, Planes.Height), mThreadCount),
+    CountsB,
+    CountsG,
+    CountsR);
+
+  FoldHistogram(CountsB, mBinCount, HistB);
+  FoldHistogram(CountsG, mBinCount, HistG);
+  FoldHistogram(CountsR, mBinCount, HistR);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a value histogram of a YUV frame.  Every pixel is counted.
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramValueYUV(
+  const cv::Mat& Image,
+  EHistYUVLayout Layout,
+  cv::MatND& Hist)
+{
+  const CYUVPlanes Planes = GetYUVPlanes(Image, Layout);
+
+  unsigned Counts[HIST_LIB_LEVELS] = {0};
+
+  CountYUVValue(
+    Planes,
+    GetBandCount(Image.rowRange(0, Planes.Height), mThreadCount),
+    Counts);
+
+  FoldHistogram(Counts, mBinCount, Hist);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Checks a YUV 4:2:0 frame and locates its planes.  The planar layouts
+//   store two chroma rows per image row, so they need a continuous image.
+//-----------------------------------------------------------------------------
+CYUVPlanes CHistLib::GetYUVPlanes(
+  const cv::Mat& Image,
+  EHistYUVLayout Layout) const
+{
+  if ((Image.type() != CV_8UC1) || (Image.rows % 3) || (Image.cols % 2))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistLib::GetYUVPlanes");
+  }
+
+  CYUVPlanes Planes;
+  Planes.Width = Image.cols;
+  Planes.Height = Image.rows / 3 * 2;
+  Planes.pY = Image.data;
+  Planes.YStep = Image.step;
+
+  const uchar* pChroma = Image.ptr(Planes.Height);
+
+  switch (Layout)
+  {
+    case HIST_LIB_YUV_NV12:
+    case HIST_LIB_YUV_NV21:
     {
-      Mat ImageHSV = Mat(Image.size(), CV_8UC3);
-      vector<Mat> ChannlesHsv;
+      const bool IsNV12 = (Layout == HIST_LIB_YUV_NV12);
 
-      cvtColor(Image, ImageHSV, CV_BGR2HSV);
-      cv::split(ImageHSV, ChannlesHsv);
-      ImageValue = ChannlesHsv[2];
+      Planes.pU = pChroma + (IsNV12 ? 0 : 1);
+      Planes.pV = pChroma + (IsNV12 ? 1 : 0);
+      Planes.UVStep = Image.step;
+      Planes.UVPixelStep = 2;
     }
     break;
 
+    case HIST_LIB_YUV_I420:
+    case HIST_LIB_YUV_YV12:
+    {
+      if (!Image.isContinuous())
+      {
+        CV_Error(CV_StsBadArg, "CHistLib::GetYUVPlanes");
+      }
+
+      const bool IsI420 = (Layout == HIST_LIB_YUV_I420);
+      const size_t PlaneSize = (size_t)(Planes.Width / 2) * (Planes.Height / 2);
+
+      Planes.pU = pChroma + (IsI420 ? 0 : PlaneSize);
+      Planes.pV = pChroma + (IsI420 ? PlaneSize : 0);
+      Planes.UVStep = Planes.Width / 2;
+      Planes.UVPixelStep = 1;
+    }
+    break;
+
+    default:
+      CV_Error(CV_StsBadArg, "CHistLib::GetYUVPlanes");
+    break;
+  }
+
+  return Planes;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Stores a reduced count into an output bin, raising CV_StsOutOfRange when
+//   the bin cannot hold it
+//-----------------------------------------------------------------------------
+template <typename TCount>
+static void StoreCount(uint64 Count, TCount& Bin)
+{
+  if (Count > (uint64)numeric_limits<TCount>::max())
+  {
+    CV_Error(CV_StsOutOfRange, "CHistLib::ComputeCounts");
+  }
+
+  Bin = (TCount)Count;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Helper that counts every pixel into mBinCount bins of type TCount per
+//   histogram.  8-bit images are counted into exact 64-bit level totals on
+//   the stack, which are folded straight into the output bins; every bin is
+//   checked against the range of TCount after the reduce, so only a bin that
+//   really overflows is rejected.
+//-----------------------------------------------------------------------------
+template <typename TCount>
+void CHistLib::ComputeCounts(
+  const cv::Mat& Image,
+  bool IsBGR,
+  std::vector<TCount>& CountsB,
+  std::vector<TCount>* pCountsG,
+  std::vector<TCount>* pCountsR,
+  CHistWorkspace& Workspace)
+{
+  vector<TCount>* Counts[] = {&CountsB, pCountsG, pCountsR};
+
+  bool IsSupported = false;
+
+  switch (Image.type())
+  {
+    case CV_8UC3:
     case CV_8UC4:
+      IsSupported = true;
+    break;
+
+    case CV_8UC1:
+      IsSupported = !IsBGR;
+    break;
+
+    case CV_16UC3:
+    case CV_32FC3:
+      IsSupported = true;
+    break;
+
+    case CV_16UC1:
+    case CV_32FC1:
+      IsSupported = !IsBGR;
+    break;
+  }
+
+  if (!IsSupported)
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistLib::ComputeCounts");
+  }
+
+  CHistWorkspace::CBuffers& Buffers = *Workspace.mpBuffers;
+  const int HistCount = IsBGR ? 3 : 1;
+  const int BandCount = GetBandCount(Image, mThreadCount);
+
+  if (Image.depth() == CV_8U)
+  {
+    uint64 Levels[3][HIST_LIB_LEVELS] = {{0}};
+
+    CountCompact(
+      Image,
+      IsBGR,
+      BandCount,
+      Levels[0],
+      Levels[1],
+      Levels[2],
+      &Buffers.CompactCounters);
+
+    // Levels map onto the bins in order, so each bin is a run of levels
+    for (int c = 0; c < HistCount; ++c)
+    {
+      vector<TCount>& Bins = *Counts[c];
+      Bins.assign(mBinCount, 0);
+
+      unsigned Bin = 0;
+      uint64 Sum = 0;
+
+      for (unsigned i = 0; i < HIST_LIB_LEVELS; ++i)
+      {
+        const unsigned Next = (i * mBinCount) >> 8;
+
+        if (Next != Bin)
+        {
+          StoreCount(Sum, Bins[Bin]);
+          Bin = Next;
+          Sum = 0;
+        }
+
+        Sum += Levels[c][i];
+      }
+
+      StoreCount(Sum, Bins[Bin]);
+    }
+    return;
+  }
+
+  // The wide kernels keep 32-bit totals
+  if ((uint64)Image.total() > (uint64)UINT_MAX)
+  {
+    CV_Error(CV_StsOutOfRange, "CHistLib::ComputeCounts");
+  }
+
+  double Low;
+  double High;
+  GetHistRange(Image.depth(), Low, High);
+
+  vector<unsigned>* Wide = Buffers.WideCounts;
+  for (int c = 0; c < HistCount; ++c)
+  {
+    Wide[c].assign(mBinCount, 0);
+  }
+
+  CountWide(
+    Image,
+    mBinCount,
+    Low,
+    High,
+    IsBGR,
+    BandCount,
+    &Wide[0][0],
+    IsBGR ? &Wide[1][0] : 0,
+    IsBGR ? &Wide[2][0] : 0,
+    &Buffers.WideCounters);
+
+  for (int c = 0; c < HistCount; ++c)
+  {
+    vector<TCount>& Bins = *Counts[c];
+    Bins.resize(mBinCount);
+
+    for (unsigned i = 0; i < mBinCount; ++i)
+    {
+      StoreCount(Wide[c][i], Bins[i]);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes exact BGR counts
+//-----------------------------------------------------------------------------
+template <typename TCount>
+void CHistLib::ComputeCountsBGR(
+  const cv::Mat& Image,
+  std::vector<TCount>& CountsB,
+  std::vector<TCount>& CountsG,
+  std::vector<TCount>& CountsR)
+{
+  CHistWorkspace Workspace;
+
+  ComputeCountsBGR(Image, CountsB, CountsG, CountsR, Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes exact BGR counts using the buffers of Workspace
+//-----------------------------------------------------------------------------
+template <typename TCount>
+void CHistLib::ComputeCountsBGR(
+  const cv::Mat& Image,
+  std::vector<TCount>& CountsB,
+  std::vector<TCount>& CountsG,
+  std::vector<TCount>& CountsR,
+  CHistWorkspace& Workspace)
+{
+  ComputeCounts(Image, true, CountsB, &CountsG, &CountsR, Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes exact value counts
+//-----------------------------------------------------------------------------
+template <typename TCount>
+void CHistLib::ComputeCountsValue(
+  const cv::Mat& Image,
+  std::vector<TCount>& Counts)
+{
+  CHistWorkspace Workspace;
+
+  ComputeCountsValue(Image, Counts, Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes exact value counts using the buffers of Workspace
+//-----------------------------------------------------------------------------
+template <typename TCount>
+void CHistLib::ComputeCountsValue(
+  const cv::Mat& Image,
+  std::vector<TCount>& Counts,
+  CHistWorkspace& Workspace)
+{
+  ComputeCounts<TCount>(Image, false, Counts, 0, 0, Workspace);
+}
+
+template void CHistLib::ComputeCountsBGR<ushort>(
+  const cv::Mat&, vector<ushort>&, vector<ushort>&, vector<ushort>&);
+template void CHistLib::ComputeCountsBGR<unsigned>(
+  const cv::Mat&, vector<unsigned>&, vector<unsigned>&, vector<unsigned>&);
+template void CHistLib::ComputeCountsBGR<uint64>(
+  const cv::Mat&,
+  vector<uint64>&,
+  vector<uint64>&,
+  vector<uint64>&);
+
+template void CHistLib::ComputeCountsBGR<ushort>(
+  const cv::Mat&,
+  vector<ushort>&,
+  vector<ushort>&,
+  vector<ushort>&,
+  CHistWorkspace&);
+template void CHistLib::ComputeCountsBGR<unsigned>(
+  const cv::Mat&,
+  vector<unsigned>&,
+  vector<unsigned>&,
+  vector<unsigned>&,
+  CHistWorkspace&);
+template void CHistLib::ComputeCountsBGR<uint64>(
+  const cv::Mat&,
+  vector<uint64>&,
+  vector<uint64>&,
+  vector<uint64>&,
+  CHistWorkspace&);
+
+template void CHistLib::ComputeCountsValue<ushort>(
+  const cv::Mat&, vector<ushort>&);
+template void CHistLib::ComputeCountsValue<unsigned>(
+  const cv::Mat&, vector<unsigned>&);
+template void CHistLib::ComputeCountsValue<uint64>(
+  const cv::Mat&, vector<uint64>&);
+
+template void CHistLib::ComputeCountsValue<ushort>(
+  const cv::Mat&, vector<ushort>&, CHistWorkspace&);
+template void CHistLib::ComputeCountsValue<unsigned>(
+  const cv::Mat&, vector<unsigned>&, CHistWorkspace&);
+template void CHistLib::ComputeCountsValue<uint64>(
+  const cv::Mat&, vector<uint64>&, CHistWorkspace&);
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool CHistLib::IsSampling() const
+{
+  return (mSampling != HIST_LIB_SAMPLE_ALL) && (mSampleFraction < 1.0);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Rescales a histogram of Sampled pixels to Total pixels.  The error of each
+//   bin is the half-width of the 95% confidence interval of the scaled count,
+//   from the binomial variance with a finite population correction.  It is
+//   zero when every pixel was counted.
+//-----------------------------------------------------------------------------
+void CHistLib::ScaleSampledHistogram(
+  cv::MatND& Hist,
+  double Sampled,
+  double Total,
+  cv::MatND* pHistError)
+{
+  if (pHistError)
+  {
+    pHistError->create(Hist.rows, Hist.cols, CV_32F);
+    pHistError->setTo(Scalar(0));
+  }
+
+  if (Sampled >= Total)
+  {
+    return;
+  }
+
+  const double Scale = (Sampled > 0) ? (Total / Sampled) : 0;
+  const double Correction = (Total - Sampled) / (Total - 1);
+
+  for (int i = 0; i < Hist.rows; ++i)
+  {
+    const double Count = Hist.at<float>(i, 0);
+
+    if (pHistError && (Sampled > 0))
     {
-      Mat ImageHSV = Mat(Image.size(), CV_8UC3);
-      Mat ImageBGR = Mat(Image.size(), CV_8UC3);
-      vector<Mat> ChannlesHsv;
-
-      cvtColor(Image, ImageBGR, CV_RGBA2RGB);
-      cvtColor(ImageBGR, ImageHSV, CV_RGBA2RGB);
-      cv::split(ImageHSV, ChannlesHsv);
-      ImageValue = ChannlesHsv[2];
+      const double p = Count / Sampled;
+      pHistError->at<float>(i, 0) = (float)(
+        1.96 * Total * sqrt(p * (1 - p) / Sampled * Correction));
     }
+
+    Hist.at<float>(i, 0) = (float)(Count * Scale);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes a value histogram for every tile of a grid in a single pass
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramValueTiles(
+  const cv::Mat& Image,
+  unsigned TilesX,
+  unsigned TilesY,
+  cv::Mat& Hists)
+{
+  switch (Image.type())
+  {
+    case CV_8UC1:
+    case CV_8UC3:
+    case CV_8UC4:
+    break;
+
+    default:
+      CV_Error(CV_StsUnsupportedFormat, "CHistLib::ComputeHistogramValueTiles");
+    break;
+  }
+
+  CheckTileGrid(Image, TilesX, TilesY);
+
+  const unsigned Tiles = TilesX * TilesY;
+  vector<unsigned> Counts(Tiles * HIST_LIB_LEVELS, 0);
+
+  CountValueTiles(Image, TilesX, TilesY, mThreadCount, &Counts[0]);
+
+  FoldTiles(&Counts[0], Tiles, Hists);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes BGR histograms for every tile of a grid in a single pass
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeHistogramBGRTiles(
+  const cv::Mat& Image,
+  unsigned TilesX,
+  unsigned TilesY,
+  cv::Mat& HistsB,
+  cv::Mat& HistsG,
+  cv::Mat& HistsR)
+{
+  switch (Image.type())
+  {
+    case CV_8UC3:
+    case CV_8UC4:
     break;
 
     default:
-      CV_Error(CV_StsUnsupportedFormat, "CHistLib::DrawHistogramValue");
+      CV_Error(CV_StsUnsupportedFormat, "CHistLib::ComputeHistogramBGRTiles");
     break;
   }
 
-  // Initialize histogram settings
-  int histSize[] = { mBinCount };
-  float Range[] = { 0, 256 }; //{0, 256} = 0 to 255
-  const float *Ranges[] = { Range };
-  int channels[] = { 0 };
+  CheckTileGrid(Image, TilesX, TilesY);
+
+  const unsigned Tiles = TilesX * TilesY;
+  vector<unsigned> CountsB(Tiles * HIST_LIB_LEVELS, 0);
+  vector<unsigned> CountsG(Tiles * HIST_LIB_LEVELS, 0);
+  vector<unsigned> CountsR(Tiles * HIST_LIB_LEVELS, 0);
+
+  CountBGRTiles(
+    Image,
+    TilesX,
+    TilesY,
+    mThreadCount,
+    &CountsB[0],
+    &CountsG[0],
+    &CountsR[0]);
+
+  FoldTiles(&CountsB[0], Tiles, HistsB);
+  FoldTiles(&CountsG[0], Tiles, HistsG);
+  FoldTiles(&CountsR[0], Tiles, HistsR);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Every tile must contain at least one pixel
+//-----------------------------------------------------------------------------
+void CHistLib::CheckTileGrid(
+  const cv::Mat& Image,
+  unsigned TilesX,
+  unsigned TilesY)
+{
+  if ((TilesX == 0) || (TilesY == 0) ||
+      (TilesX > (unsigned)Image.cols) || (TilesY > (unsigned)Image.rows))
+  {
+    CV_Error(CV_StsBadArg, "CHistLib::CheckTileGrid");
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Folds the 256 level counts of every tile into one row of Hists
+//-----------------------------------------------------------------------------
+void CHistLib::FoldTiles(const unsigned* Counts, unsigned Tiles, cv::Mat& Hists)
+{
+  Hists.create(Tiles, mBinCount, CV_32F);
 
-  calcHist(&ImageValue, 1, channels, Mat(), // do not use mask
-    Hist,
-    1,
-    histSize,
-    Ranges,
-    true, // the histogram is uniform
-    false);
+  for (unsigned t = 0; t < Tiles; ++t)
+  {
+    FoldBins(Counts + t * HIST_LIB_LEVELS, mBinCount, Hists.ptr<float>(t));
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -330,53 +1345,86 @@ void CHistLib::DrawHistogramBGR(
   cv::MatND& HistR,
   cv::Mat& HistImage)
 {
+  CHistWorkspace Workspace;
+
+  DrawHistogramBGR(HistB, HistG, HistR, HistImage, Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Normalizes and draws a three channel (BGR) histogram.  The merged wide
+//   histograms and the colour layer are kept in Workspace.
+//-----------------------------------------------------------------------------
+void CHistLib::DrawHistogramBGR(
+  cv::MatND& HistB,
+  cv::MatND& HistG,
+  cv::MatND& HistR,
+  cv::Mat& HistImage,
+  CHistWorkspace& Workspace)
+{
+  CHistWorkspace::CBuffers& Buffers = *Workspace.mpBuffers;
+
+  // Wide histograms are merged into at most HIST_LIB_MAX_DRAW_BINS bins and
+  // the reduced copies are normalized instead of the inputs
+  const unsigned LastBin = HistB.rows - 1;
+  MatND* Reduced = Buffers.Reduced;
+
+  MatND& DrawB = ReduceForDrawing(HistB, Reduced[0]) ? Reduced[0] : HistB;
+  MatND& DrawG = ReduceForDrawing(HistG, Reduced[1]) ? Reduced[1] : HistG;
+  MatND& DrawR = ReduceForDrawing(HistR, Reduced[2]) ? Reduced[2] : HistR;
+
   double maxB = 0;
   double maxG = 0;
   double maxR = 0;
 
-  minMaxLoc(HistB, 0, &maxB, 0, 0);
-  minMaxLoc(HistG, 0, &maxG, 0, 0);
-  minMaxLoc(HistR, 0, &maxR, 0, 0);
+  minMaxLoc(DrawB, 0, &maxB, 0, 0);
+  minMaxLoc(DrawG, 0, &maxG, 0, 0);
+  minMaxLoc(DrawR, 0, &maxR, 0, 0);
 
   double maxBGR = max(maxB, max(maxG, maxR));
 
-  for (int i = 0; i < HistB.rows; ++i)
+  for (int i = 0; i < DrawB.rows; ++i)
   {
-    HistB.at<float>(i, 0) = (float) mHistImageHeight * HistB.at<float>(i, 0)
+    DrawB.at<float>(i, 0) = (float) mHistImageHeight * DrawB.at<float>(i, 0)
         / (float) maxBGR;
-    HistG.at<float>(i, 0) = (float) mHistImageHeight * HistG.at<float>(i, 0)
+    DrawG.at<float>(i, 0) = (float) mHistImageHeight * DrawG.at<float>(i, 0)
         / (float) maxBGR;
-    HistR.at<float>(i, 0) = (float) mHistImageHeight * HistR.at<float>(i, 0)
+    DrawR.at<float>(i, 0) = (float) mHistImageHeight * DrawR.at<float>(i, 0)
         / (float) maxBGR;
   }
 
   // Should do nothing if the input is already the correct size/type
   HistImage.create(
     2 * mHistImageBorder + mHistImageHeight,
-    2 * mHistImageBorder + mSpread * mBinCount,
+    2 * mHistImageBorder + mSpread * DrawB.rows,
     CV_8UC3);
 
   HistImage.setTo(mHistBackgroundColor);
 
-  DrawHistBins(HistB, HistImage, HIST_LIB_COLOR_BLACK);
-  DrawHistBins(HistG, HistImage, HIST_LIB_COLOR_BLACK);
-  DrawHistBins(HistR, HistImage, HIST_LIB_COLOR_BLACK);
+  DrawHistBins(DrawB, HistImage, HIST_LIB_COLOR_BLACK);
+  DrawHistBins(DrawG, HistImage, HIST_LIB_COLOR_BLACK);
+  DrawHistBins(DrawR, HistImage, HIST_LIB_COLOR_BLACK);
+
+  // Each colour is drawn on a cleared layer and added to the plot, so a
+  // single layer is enough
+  Mat& Layer = Buffers.Layer;
+  Layer.create(HistImage.size(), HistImage.type());
 
-  Mat AddB(HistImage.size(), HistImage.type(), HIST_LIB_COLOR_BLACK);
-  Mat AddG(HistImage.size(), HistImage.type(), HIST_LIB_COLOR_BLACK);
-  Mat AddR(HistImage.size(), HistImage.type(), HIST_LIB_COLOR_BLACK);
+  Layer.setTo(HIST_LIB_COLOR_BLACK);
+  DrawHistBins(DrawB, Layer, HIST_LIB_COLOR_BLUE);
+  add(HistImage, Layer, HistImage);
 
-  DrawHistBins(HistB, AddB, HIST_LIB_COLOR_BLUE);
-  DrawHistBins(HistG, AddG, HIST_LIB_COLOR_GREEN);
-  DrawHistBins(HistR, AddR, HIST_LIB_COLOR_RED);
+  Layer.setTo(HIST_LIB_COLOR_BLACK);
+  DrawHistBins(DrawG, Layer, HIST_LIB_COLOR_GREEN);
+  add(HistImage, Layer, HistImage);
 
-  add(HistImage, AddB, HistImage);
-  add(HistImage, AddG, HistImage);
-  add(HistImage, AddR, HistImage);
+  Layer.setTo(HIST_LIB_COLOR_BLACK);
+  DrawHistBins(DrawR, Layer, HIST_LIB_COLOR_RED);
+  add(HistImage, Layer, HistImage);
 
   if (mDrawXAxis)
   {
-    DrawHistBar(HistImage, mBinCount);
+    DrawHistBar(HistImage, DrawB.rows, LastBin);
   }
 }
 
@@ -386,16 +1434,63 @@ void CHistLib::DrawHistogramBGR(
 //-----------------------------------------------------------------------------
 void CHistLib::DrawHistogramValue(cv::MatND& Hist, cv::Mat& HistImage)
 {
+  CHistWorkspace Workspace;
+
+  DrawHistogramValue(Hist, HistImage, Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Normalizes and draws a single channel histogram, merging wide histograms
+//   into a buffer of Workspace
+//-----------------------------------------------------------------------------
+void CHistLib::DrawHistogramValue(
+  cv::MatND& Hist,
+  cv::Mat& HistImage,
+  CHistWorkspace& Workspace)
+{
+  const unsigned LastBin = Hist.rows - 1;
+  MatND& Reduced = Workspace.mpBuffers->Reduced[0];
+  MatND& Draw = ReduceForDrawing(Hist, Reduced) ? Reduced : Hist;
+
   double maxVal = 0;
-  minMaxLoc(Hist, 0, &maxVal, 0, 0);
+  minMaxLoc(Draw, 0, &maxVal, 0, 0);
 
-  for (int i = 0; i < Hist.rows; ++i)
+  for (int i = 0; i < Draw.rows; ++i)
   {
-    Hist.at<float>(i, 0) = (float) mHistImageHeight * Hist.at<float>(i, 0)
+    Draw.at<float>(i, 0) = (float) mHistImageHeight * Draw.at<float>(i, 0)
         / (float) maxVal;
   }
 
-  DrawHistogram(Hist, HistImage);
+  DrawHistogram(Draw, HistImage, LastBin);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Merges groups of neighbouring bins of a histogram with more than
+//   HIST_LIB_MAX_DRAW_BINS bins.  Returns false (and leaves HistReduced
+//   untouched) when the histogram is narrow enough to be drawn as is.
+//-----------------------------------------------------------------------------
+bool CHistLib::ReduceForDrawing(const cv::MatND& Hist, cv::MatND& HistReduced)
+{
+  if (Hist.rows <= HIST_LIB_MAX_DRAW_BINS)
+  {
+    return false;
+  }
+
+  const int Group = (Hist.rows + HIST_LIB_MAX_DRAW_BINS - 1)
+    / HIST_LIB_MAX_DRAW_BINS;
+  const int Reduced = (Hist.rows + Group - 1) / Group;
+
+  HistReduced.create(Reduced, 1, CV_32F);
+  HistReduced.setTo(Scalar(0));
+
+  for (int i = 0; i < Hist.rows; ++i)
+  {
+    HistReduced.at<float>(i / Group, 0) += Hist.at<float>(i, 0);
+  }
+
+  return true;
 }
 
 //-----------------------------------------------------------------------------
@@ -404,11 +1499,26 @@ void CHistLib::DrawHistogramValue(cv::MatND& Hist, cv::Mat& HistImage)
 //-----------------------------------------------------------------------------
 void CHistLib::ComputeAndDrawHistogramValue(const Mat& Image, Mat& ImageHist)
 {
-  MatND Hist;
+  CHistWorkspace Workspace;
+
+  ComputeAndDrawHistogramValue(Image, ImageHist, Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes and draws a single channel (value) histogram, keeping the
+//   histogram in Workspace
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeAndDrawHistogramValue(
+  const Mat& Image,
+  Mat& ImageHist,
+  CHistWorkspace& Workspace)
+{
+  MatND& Hist = Workspace.mpBuffers->Hists[0];
 
-  ComputeHistogramValue(Image, Hist);
+  ComputeHistogramValue(Image, Hist, Workspace);
 
-  DrawHistogramValue(Hist, ImageHist);
+  DrawHistogramValue(Hist, ImageHist, Workspace);
 }
 
 //-----------------------------------------------------------------------------
@@ -417,13 +1527,26 @@ void CHistLib::ComputeAndDrawHistogramValue(const Mat& Image, Mat& ImageHist)
 //-----------------------------------------------------------------------------
 void CHistLib::ComputeAndDrawHistogramBGR(const Mat& Image, Mat& HistImage)
 {
-  MatND HistB;
-  MatND HistG;
-  MatND HistR;
+  CHistWorkspace Workspace;
+
+  ComputeAndDrawHistogramBGR(Image, HistImage, Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Computes and draws a three channel (BGR) histogram, keeping the
+//   histograms in Workspace
+//-----------------------------------------------------------------------------
+void CHistLib::ComputeAndDrawHistogramBGR(
+  const Mat& Image,
+  Mat& HistImage,
+  CHistWorkspace& Workspace)
+{
+  MatND* Hists = Workspace.mpBuffers->Hists;
 
-  ComputeHistogramBGR(Image, HistB, HistG, HistR);
+  ComputeHistogramBGR(Image, Hists[0], Hists[1], Hists[2], Workspace);
 
-  DrawHistogramBGR(HistB, HistG, HistR, HistImage);
+  DrawHistogramBGR(Hists[0], Hists[1], Hists[2], HistImage, Workspace);
 }
 
 //-----------------------------------------------------------------------------
@@ -431,6 +1554,16 @@ void CHistLib::ComputeAndDrawHistogramBGR(const Mat& Image, Mat& HistImage)
 //   Draws the x axis of the histogram plot
 //-----------------------------------------------------------------------------
 void CHistLib::DrawHistBar(Mat& HistImage, unsigned BinCount)
+{
+  DrawHistBar(HistImage, BinCount, BinCount - 1);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Draws the x axis of the histogram plot.  LastBin is used as the label of
+//   the last bin, which differs from BinCount - 1 for merged wide histograms.
+//-----------------------------------------------------------------------------
+void CHistLib::DrawHistBar(Mat& HistImage, unsigned BinCount, unsigned LastBin)
 {
   // Draw the horizontal axis
   line(
@@ -453,7 +1586,7 @@ void CHistLib::DrawHistBar(Mat& HistImage, unsigned BinCount)
 
   // Create text to display number of histogram bins
   stringstream mBinCountSS;
-  mBinCountSS << (BinCount - 1);
+  mBinCountSS << LastBin;
 
   // Label last bin
   putText(
@@ -473,52 +1606,74 @@ void CHistLib::DrawHistBar(Mat& HistImage, unsigned BinCount)
 //-----------------------------------------------------------------------------
 void CHistLib::NormalizeImageBGR(const Mat& ImageBGR, Mat& ImageBGRNorm)
 {
-  Mat ImageHSV     = Mat(ImageBGR.size(), CV_8UC3);
-  Mat ImageHSVNorm = Mat(ImageBGR.size(), CV_8UC3);
+  CHistWorkspace Workspace;
 
-  cvtColor(ImageBGR, ImageHSV, CV_BGR2HSV);
+  NormalizeImageBGR(ImageBGR, ImageBGRNorm, Workspace);
+}
 
-  unsigned char* data     = ImageHSV.data;
-  unsigned char* dataNorm = ImageHSVNorm.data;
+//-----------------------------------------------------------------------------
+// Description:
+//   Scale the value channel to the max, reusing the counters of Workspace
+//-----------------------------------------------------------------------------
+void CHistLib::NormalizeImageBGR(
+  const Mat& ImageBGR,
+  Mat& ImageBGRNorm,
+  CHistWorkspace& Workspace)
+{
+  const Rect Whole(0, 0, ImageBGR.cols, ImageBGR.rows);
 
-  // The normalization procedure here is performed with efficiency in mind
-  // Find min/max from the value channel
-  unsigned char min = 255;
-  unsigned char max = 0;
-  for ( int i = 0; i < ImageHSV.rows*ImageHSV.cols; ++i)
-  {
-    if( data[3*i+2] > max) max = data[3*i+2];
-    if( data[3*i+2] < min) min = data[3*i+2];
-  }
+  NormalizeImageBGR(ImageBGR, ImageBGRNorm, Whole, Whole, Workspace);
+}
 
-  for ( int i = 0; i < ImageHSV.rows*ImageHSV.cols; ++i)
-  {
-    dataNorm[3*i]   = data[3*i];// Hue
-    dataNorm[3*i+1] = data[3*i+1];//Saturation
+//-----------------------------------------------------------------------------
+// Description:
+//   Scale the value channel of ApplyRegion so that the values found in
+//   StatsRegion span the full range
+//-----------------------------------------------------------------------------
+void CHistLib::NormalizeImageBGR(
+  const Mat& ImageBGR,
+  Mat& ImageBGRNorm,
+  const Rect& StatsRegion,
+  const Rect& ApplyRegion)
+{
+  CHistWorkspace Workspace;
+
+  NormalizeImageBGR(
+    ImageBGR,
+    ImageBGRNorm,
+    StatsRegion,
+    ApplyRegion,
+    Workspace);
+}
 
-    double newPixelDouble =
-      (double)((double)data[3*i+2]-(double)min)*(255.0f/(double)(max-min));
+//-----------------------------------------------------------------------------
+// Description:
+//   Region variant that reuses the counters of Workspace
+//-----------------------------------------------------------------------------
+void CHistLib::NormalizeImageBGR(
+  const Mat& ImageBGR,
+  Mat& ImageBGRNorm,
+  const Rect& StatsRegion,
+  const Rect& ApplyRegion,
+  CHistWorkspace& Workspace)
+{
+  unsigned bins[HIST_LIB_LEVELS] = {0};
+  CountNormalizeValues(ImageBGR, StatsRegion, bins, Workspace);
 
-    unsigned char newPixelByte;
+  // Find min/max from the value histogram
+  int min = 0;
+  int max = HIST_LIB_LEVELS - 1;
+  while ((min < max) && !bins[min]) min++;
+  while ((max > min) && !bins[max]) max--;
 
-    if (newPixelDouble > 255) // Take care of positive clipping
-    {
-      newPixelByte = 255;
-    }
-    else if(newPixelDouble < 0) // Take care of negative clipping
-    {
-      newPixelByte = 0;
-    }
-    else // If there is no clipping
-    {
-      newPixelByte = cvRound(newPixelDouble);
-    }
+  // Only 256 values exist, so the stretch is evaluated once per value
+  uchar Stretch[HIST_LIB_LEVELS];
+  BuildNormalizeStretch(min, max, Stretch);
 
-     // Value
-    dataNorm[3*i+2] = newPixelByte;
+  unsigned Scales[HIST_LIB_LEVELS];
+  BuildValueScales(Stretch, Scales);
 
-  }
-  cvtColor(ImageHSVNorm, ImageBGRNorm, CV_HSV2BGR);
+  ApplyNormalizeScales(ImageBGR, ImageBGRNorm, ApplyRegion, Scales);
 }
 
 //-----------------------------------------------------------------------------
@@ -530,90 +1685,424 @@ void CHistLib::NormalizeClipImageBGR(
   Mat& ImageBGRNorm,
   double clipPercent)
 {
+  CHistWorkspace Workspace;
 
-  Mat ImageHSV     = Mat(ImageBGR.size(), CV_8UC3);
-  Mat ImageHSVNorm = Mat(ImageBGR.size(), CV_8UC3);
-
-  cvtColor(ImageBGR, ImageHSV, CV_BGR2HSV);
+  NormalizeClipImageBGR(ImageBGR, ImageBGRNorm, clipPercent, Workspace);
+}
 
-  unsigned char* data     = ImageHSV.data;
-  unsigned char* dataNorm = ImageHSVNorm.data;
+//-----------------------------------------------------------------------------
+// Description:
+//   Scale the value channel to a target clipping amount, reusing the
+//   counters of Workspace
+//-----------------------------------------------------------------------------
+void CHistLib::NormalizeClipImageBGR(
+  const Mat& ImageBGR,
+  Mat& ImageBGRNorm,
+  double clipPercent,
+  CHistWorkspace& Workspace)
+{
+  const Rect Whole(0, 0, ImageBGR.cols, ImageBGR.rows);
+
+  NormalizeClipImageBGR(
+    ImageBGR,
+    ImageBGRNorm,
+    Whole,
+    Whole,
+    clipPercent,
+    Workspace);
+}
 
-  unsigned bins[mBinCount];
-  memset(bins, 0, mBinCount*sizeof(unsigned));
-  unsigned max = mBinCount-1;
-  unsigned min = 0;
+//-----------------------------------------------------------------------------
+// Description:
+//   Scale the value channel of ApplyRegion using clip points found in
+//   StatsRegion
+//-----------------------------------------------------------------------------
+void CHistLib::NormalizeClipImageBGR(
+  const Mat& ImageBGR,
+  Mat& ImageBGRNorm,
+  const Rect& StatsRegion,
+  const Rect& ApplyRegion,
+  double clipPercent)
+{
+  CHistWorkspace Workspace;
+
+  NormalizeClipImageBGR(
+    ImageBGR,
+    ImageBGRNorm,
+    StatsRegion,
+    ApplyRegion,
+    clipPercent,
+    Workspace);
+}
 
-  for (int i = 0; i < ImageHSV.rows*ImageHSV.cols; ++i)
-  {
-    bins[data[3*i+2]]++;
-  }
+//-----------------------------------------------------------------------------
+// Description:
+//   Region variant that reuses the counters of Workspace
+//-----------------------------------------------------------------------------
+void CHistLib::NormalizeClipImageBGR(
+  const Mat& ImageBGR,
+  Mat& ImageBGRNorm,
+  const Rect& StatsRegion,
+  const Rect& ApplyRegion,
+  double clipPercent,
+  CHistWorkspace& Workspace)
+{
+  unsigned bins[HIST_LIB_LEVELS] = {0};
+  CountNormalizeValues(ImageBGR, StatsRegion, bins, Workspace);
 
   // Maximum number of pixels to remove from the histogram
   // This is calculated by taking a percentage of the total number of pixels
   const double clipFraction = clipPercent / 100.0f;
   unsigned pixelsToClip = cvRound(
-    clipFraction * (double) (ImageHSV.rows * ImageHSV.cols));
+    clipFraction * (double) StatsRegion.area());
   unsigned pixelsToClipHalf = cvRound((double) pixelsToClip / 2);
-  unsigned binSum = 0;
 
-  // Find the lower pixel bound
-  if (bins[0] < pixelsToClipHalf)
+  // Find the lower and upper pixel bounds
+  unsigned min;
+  unsigned max;
+  CCumulativeHist& Cumulative = Workspace.mpBuffers->ValueCumulative;
+  Cumulative.SetCounts(bins, HIST_LIB_LEVELS);
+  Cumulative.FindClipPoints(pixelsToClipHalf, min, max);
+
+  uchar Stretch[HIST_LIB_LEVELS];
+  BuildNormalizeStretch(min, max, Stretch);
+
+  unsigned Scales[HIST_LIB_LEVELS];
+  BuildValueScales(Stretch, Scales);
+
+  ApplyNormalizeScales(ImageBGR, ImageBGRNorm, ApplyRegion, Scales);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Scales each channel to a target clipping amount
+//-----------------------------------------------------------------------------
+void CHistLib::NormalizeClipImageBGRPerChannel(
+  const Mat& ImageBGR,
+  Mat& ImageBGRNorm,
+  double clipPercent)
+{
+  CHistWorkspace Workspace;
+
+  NormalizeClipImageBGRPerChannel(
+    ImageBGR,
+    ImageBGRNorm,
+    clipPercent,
+    Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   The clip points of each channel are found exactly as for the value
+//   channel in NormalizeClipImageBGR.  A channel whose clip points meet (a
+//   flat channel) is left unchanged.  Alpha is copied.
+//-----------------------------------------------------------------------------
+void CHistLib::NormalizeClipImageBGRPerChannel(
+  const Mat& ImageBGR,
+  Mat& ImageBGRNorm,
+  double clipPercent,
+  CHistWorkspace& Workspace)
+{
+  if ((ImageBGR.type() != CV_8UC3) && (ImageBGR.type() != CV_8UC4))
   {
-    binSum = bins[0];
-    for (unsigned i = 1; i < 255; ++i)
-    {
-      binSum = binSum + bins[i];
-      if (binSum > pixelsToClipHalf)
-      {
-        min = i;
-        break;
-      }
-    }
+    CV_Error(
+      CV_StsUnsupportedFormat,
+      "CHistLib::NormalizeClipImageBGRPerChannel");
   }
 
-  // Find the upper pixel bound
-  if (bins[255] < pixelsToClipHalf)
+  CHistWorkspace::CBuffers& Buffers = *Workspace.mpBuffers;
+
+  // One pass for all three channel histograms
+  unsigned bins[3][HIST_LIB_LEVELS] = {{0}};
+  CountBGR(
+    ImageBGR,
+    GetBandCount(ImageBGR, mThreadCount),
+    bins[0],
+    bins[1],
+    bins[2],
+    &Buffers.BGRCounters);
+
+  const double clipFraction = clipPercent / 100.0f;
+  unsigned pixelsToClip = cvRound(clipFraction * (double) ImageBGR.total());
+  unsigned pixelsToClipHalf = cvRound((double) pixelsToClip / 2);
+
+  uchar Low[3];
+  uchar Range[3];
+
+  for (int c = 0; c < 3; ++c)
   {
-    binSum = bins[255];
-    for (unsigned i = 255; i > 1; i--)
-    {
-      binSum = binSum + bins[i];
-      if (binSum > pixelsToClipHalf)
-      {
-        max = i;
-        break;
-      }
-    }
+    unsigned min;
+    unsigned max;
+    Buffers.ValueCumulative.SetCounts(bins[c], HIST_LIB_LEVELS);
+    Buffers.ValueCumulative.FindClipPoints(pixelsToClipHalf, min, max);
+
+    // A flat channel maps onto itself
+    Low[c] = (max > min) ? (uchar)min : 0;
+    Range[c] = (max > min) ? (uchar)(max - min) : 255;
   }
 
-  for ( int i = 0; i < ImageHSV.rows*ImageHSV.cols; ++i)
+  if (mNormalizeFixedPoint)
   {
-    dataNorm[3*i]   = data[3*i];// Hue
-    dataNorm[3*i+1] = data[3*i+1];//Saturation
+    ApplyChannelStretch(
+      ImageBGR,
+      ImageBGRNorm,
+      Low,
+      Range,
+      GetBandCount(ImageBGR, mThreadCount));
+    return;
+  }
 
-     // Value
-    double newPixelDouble =
-      (double)((double)data[3*i+2]-(double)min)*(255.0f/(double)(max-min));
+  uchar Stretch[3][HIST_LIB_LEVELS];
+  for (int c = 0; c < 3; ++c)
+  {
+    BuildStretchLut(Low[c], 255.0f/(double)Range[c], Stretch[c]);
+  }
 
-    unsigned char newPixelByte;
+  // Interleave the tables so a single cv::LUT pass applies all of them
+  const int Channels = ImageBGR.channels();
+  Buffers.ChannelLut.create(1, HIST_LIB_LEVELS, CV_8UC(Channels));
 
-    if (newPixelDouble > 255) // Take care of positive clipping
+  uchar* pLut = Buffers.ChannelLut.ptr<uchar>();
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    for (int c = 0; c < 3; ++c)
     {
-      newPixelByte = 255;
+      pLut[i * Channels + c] = Stretch[c][i];
     }
-    else if(newPixelDouble < 0) // Take care of negative clipping
+
+    if (Channels == 4)
     {
-      newPixelByte = 0;
+      pLut[i * Channels + 3] = (uchar)i;
     }
-    else // If there is no clipping
+  }
+
+  LUT(ImageBGR, Buffers.ChannelLut, ImageBGRNorm);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Equalizes the value channel
+//-----------------------------------------------------------------------------
+void CHistLib::EqualizeImageBGR(const Mat& ImageBGR, Mat& ImageBGREq)
+{
+  CHistWorkspace Workspace;
+
+  EqualizeImageBGR(ImageBGR, ImageBGREq, Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Equalizes the value channel, reusing the counters of Workspace.  The
+//   equalization table is turned into per value scale factors, so the image
+//   is rewritten by the same fused kernel as the normalization functions.
+//-----------------------------------------------------------------------------
+void CHistLib::EqualizeImageBGR(
+  const Mat& ImageBGR,
+  Mat& ImageBGREq,
+  CHistWorkspace& Workspace)
+{
+  const Rect Whole(0, 0, ImageBGR.cols, ImageBGR.rows);
+
+  unsigned bins[HIST_LIB_LEVELS] = {0};
+  CountNormalizeValues(ImageBGR, Whole, bins, Workspace);
+
+  uchar Equalize[HIST_LIB_LEVELS];
+  BuildEqualizeLut(bins, Equalize);
+
+  unsigned Scales[HIST_LIB_LEVELS];
+  BuildValueScales(Equalize, Scales);
+
+  ApplyValueScales(
+    ImageBGR,
+    ImageBGREq,
+    Scales,
+    GetBandCount(ImageBGR, mThreadCount));
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Adaptive equalization of the value channel
+//-----------------------------------------------------------------------------
+void CHistLib::EqualizeAdaptiveImageBGR(
+  const Mat& ImageBGR,
+  Mat& ImageBGREq,
+  unsigned TilesX,
+  unsigned TilesY,
+  double ClipLimit)
+{
+  CHistWorkspace Workspace;
+
+  EqualizeAdaptiveImageBGR(
+    ImageBGR,
+    ImageBGREq,
+    TilesX,
+    TilesY,
+    ClipLimit,
+    Workspace);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Adaptive equalization in three steps: one pass counts the value
+//   histograms of all tiles, the tile tables are built in parallel, and one
+//   fused pass interpolates the tables and rescales every pixel
+//-----------------------------------------------------------------------------
+void CHistLib::EqualizeAdaptiveImageBGR(
+  const Mat& ImageBGR,
+  Mat& ImageBGREq,
+  unsigned TilesX,
+  unsigned TilesY,
+  double ClipLimit,
+  CHistWorkspace& Workspace)
+{
+  if ((ImageBGR.type() != CV_8UC3) && (ImageBGR.type() != CV_8UC4))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistLib::EqualizeAdaptiveImageBGR");
+  }
+
+  CheckTileGrid(ImageBGR, TilesX, TilesY);
+
+  CHistWorkspace::CBuffers& Buffers = *Workspace.mpBuffers;
+  const unsigned Tiles = TilesX * TilesY;
+
+  Buffers.TileCounts.assign(Tiles * HIST_LIB_LEVELS, 0);
+  Buffers.TileLuts.resize(Tiles * HIST_LIB_LEVELS);
+
+  CountValueTiles(
+    ImageBGR,
+    TilesX,
+    TilesY,
+    mThreadCount,
+    &Buffers.TileCounts[0]);
+
+  BuildTileEqualizeLuts(
+    &Buffers.TileCounts[0],
+    Tiles,
+    ClipLimit,
+    mThreadCount,
+    &Buffers.TileLuts[0]);
+
+  ApplyTileLuts(
+    ImageBGR,
+    ImageBGREq,
+    &Buffers.TileLuts[0],
+    TilesX,
+    TilesY,
+    GetBandCount(ImageBGR, mThreadCount),
+    Buffers.ColTiles,
+    Buffers.ColWeights);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Builds the value stretch of [Low, High] onto [0, 255] with the arithmetic
+//   selected by SetNormalizeFixedPoint.  Inverted bounds keep the floating
+//   point formula in both modes.
+//-----------------------------------------------------------------------------
+void CHistLib::BuildNormalizeStretch(
+  unsigned Low,
+  unsigned High,
+  uchar* Stretch) const
+{
+  if (mNormalizeFixedPoint && (High >= Low))
+  {
+    BuildFixedStretchLut(Low, High - Low, Stretch);
+  }
+  else
+  {
+    BuildStretchLut(Low, 255.0f/(double)(High-Low), Stretch);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts the HSV value (max of B, G and R) of a region of a CV_8UC3/CV_8UC4
+//   image for the normalization functions
+//-----------------------------------------------------------------------------
+void CHistLib::CountNormalizeValues(
+  const Mat& ImageBGR,
+  const Rect& StatsRegion,
+  unsigned* Counts,
+  CHistWorkspace& Workspace)
+{
+  if ((ImageBGR.type() != CV_8UC3) && (ImageBGR.type() != CV_8UC4))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistLib::NormalizeImageBGR");
+  }
+
+  const Rect Whole(0, 0, ImageBGR.cols, ImageBGR.rows);
+
+  if (((StatsRegion & Whole) != StatsRegion) || (StatsRegion.area() == 0))
+  {
+    CV_Error(CV_StsBadArg, "CHistLib::NormalizeImageBGR");
+  }
+
+  const Mat Stats = ImageBGR(StatsRegion);
+
+  CountValue(
+    Stats,
+    GetBandCount(Stats, mThreadCount),
+    Counts,
+    &Workspace.mpBuffers->ValueCounters);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Rescales ApplyRegion of ImageBGR into ImageBGRNorm.  When ImageBGRNorm is
+//   ImageBGR the image is modified in place and only ApplyRegion is touched;
+//   otherwise the pixels outside ApplyRegion are copied unchanged.
+//-----------------------------------------------------------------------------
+void CHistLib::ApplyNormalizeScales(
+  const Mat& ImageBGR,
+  Mat& ImageBGRNorm,
+  const Rect& ApplyRegion,
+  const unsigned* Scales)
+{
+  const Rect Whole(0, 0, ImageBGR.cols, ImageBGR.rows);
+
+  if ((ApplyRegion & Whole) != ApplyRegion)
+  {
+    CV_Error(CV_StsBadArg, "CHistLib::NormalizeImageBGR");
+  }
+
+  // Should do nothing if the output is already the correct size/type, which
+  // includes the in place case
+  ImageBGRNorm.create(ImageBGR.size(), ImageBGR.type());
+
+  if (ImageBGRNorm.data != ImageBGR.data)
+  {
+    const Point End = ApplyRegion.br();
+
+    // The bands above and below the region, then the parts left and right
+    const Rect Outside[] =
+    {
+      Rect(0, 0, Whole.width, ApplyRegion.y),
+      Rect(0, End.y, Whole.width, Whole.height - End.y),
+      Rect(0, ApplyRegion.y, ApplyRegion.x, ApplyRegion.height),
+      Rect(End.x, ApplyRegion.y, Whole.width - End.x, ApplyRegion.height)
+    };
+
+    for (int i = 0; i < 4; ++i)
     {
-      newPixelByte = cvRound(newPixelDouble);
+      if (Outside[i].area() > 0)
+      {
+        Mat Target = ImageBGRNorm(Outside[i]);
+        ImageBGR(Outside[i]).copyTo(Target);
+      }
     }
+  }
 
-    dataNorm[3*i+2] = newPixelByte;
+  if (ApplyRegion.area() > 0)
+  {
+    const Mat Source = ImageBGR(ApplyRegion);
+    Mat Target = ImageBGRNorm(ApplyRegion);
+
+    ApplyValueScales(
+      Source,
+      Target,
+      Scales,
+      GetBandCount(Source, mThreadCount));
   }
-  cvtColor(ImageHSVNorm, ImageBGRNorm, CV_HSV2BGR);
 }
 
 //-----------------------------------------------------------------------------
@@ -0,0 +1,159 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#include "histMask.h"
+#include <algorithm>
+using namespace cv;
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistPackedMask::CHistPackedMask() :
+  mWordsPerRow(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistPackedMask::CHistPackedMask(const Mat& Mask) :
+  mWordsPerRow(0)
+{
+  Pack(Mask);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistPackedMask::~CHistPackedMask()
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistPackedMask::Create(Size Size)
+{
+  mSize = Size;
+  mWordsPerRow =
+    (Size.width + HIST_LIB_MASK_WORD_BITS - 1) / HIST_LIB_MASK_WORD_BITS;
+  mWords.assign((size_t)mWordsPerRow * Size.height, 0);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistPackedMask::Pack(const Mat& Mask)
+{
+  if (Mask.type() != CV_8UC1)
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistPackedMask::Pack");
+  }
+
+  Create(Mask.size());
+
+  for (int y = 0; y < Mask.rows; ++y)
+  {
+    PackMaskRow(Mask.ptr(y), Mask.cols, GetMutableRow(y));
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistPackedMask::Set(int x, int y, bool Value)
+{
+  CV_Assert((x >= 0) && (x < mSize.width) && (y >= 0) && (y < mSize.height));
+
+  uint64& Word = GetMutableRow(y)[x / HIST_LIB_MASK_WORD_BITS];
+  const uint64 Bit = (uint64)1 << (x % HIST_LIB_MASK_WORD_BITS);
+
+  if (Value)
+  {
+    Word |= Bit;
+  }
+  else
+  {
+    Word &= ~Bit;
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool CHistPackedMask::Get(int x, int y) const
+{
+  CV_Assert((x >= 0) && (x < mSize.width) && (y >= 0) && (y < mSize.height));
+
+  const uint64 Word = GetRow(y)[x / HIST_LIB_MASK_WORD_BITS];
+
+  return ((Word >> (x % HIST_LIB_MASK_WORD_BITS)) & 1) != 0;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+const uint64* CHistPackedMask::GetRow(int y) const
+{
+  return &mWords[(size_t)y * mWordsPerRow];
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+uint64* CHistPackedMask::GetMutableRow(int y)
+{
+  return &mWords[(size_t)y * mWordsPerRow];
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+Size CHistPackedMask::GetSize() const
+{
+  return mSize;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+int CHistPackedMask::GetWordsPerRow() const
+{
+  return mWordsPerRow;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void PackMaskRow(const uchar* pMask, int Width, uint64* pWords)
+{
+  for (int x = 0; x < Width; x += HIST_LIB_MASK_WORD_BITS)
+  {
+    const int Count = std::min(HIST_LIB_MASK_WORD_BITS, Width - x);
+    uint64 Word = 0;
+
+    for (int i = 0; i < Count; ++i)
+    {
+      Word |= (uint64)(pMask[x + i] != 0) << i;
+    }
+
+    pWords[x / HIST_LIB_MASK_WORD_BITS] = Word;
+  }
+}
@@ -0,0 +1,479 @@
+//=============================================================================
+// Copyright (c) 2015, Paul Filitchkin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//    * Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//    * Redistributions in binary form must reproduce the above copyright
+//      notice, this list of conditions and the following disclaimer in
+//      the documentation and/or other materials provided with the
+//      distribution.
+//
+//    * Neither the name of the organization nor the names of its contributors
+//      may be used to endorse or promote products derived from this software
+//      without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=============================================================================
+
+#include "histMatcher.h"
+#include "histKernels.h"
+#include <climits>
+#include <cstring>
+using namespace cv;
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Turns a histogram into a CDF normalized to 1.  Returns false when the
+//   histogram is empty.
+//-----------------------------------------------------------------------------
+static bool BuildCdf(const double* Hist, double* pCdf)
+{
+  double Total = 0;
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Total += Hist[i];
+  }
+
+  if (Total <= 0)
+  {
+    return false;
+  }
+
+  double Sum = 0;
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Sum += Hist[i];
+    pCdf[i] = Sum / Total;
+  }
+
+  // The last entry must reach 1 so every source level finds a match
+  pCdf[HIST_LIB_LEVELS - 1] = 1.0;
+
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Same as above for exact counts
+//-----------------------------------------------------------------------------
+static bool BuildCdf(const unsigned* Counts, double* pCdf)
+{
+  double Hist[HIST_LIB_LEVELS];
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Hist[i] = Counts[i];
+  }
+
+  return BuildCdf(Hist, pCdf);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   64-bit FNV-1a hash of a signature
+//-----------------------------------------------------------------------------
+static uint64 HashSignature(const vector<ushort>& Signature)
+{
+  uint64 Hash = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < Signature.size(); ++i)
+  {
+    Hash = (Hash ^ (Signature[i] & 0xff)) * 1099511628211ULL;
+    Hash = (Hash ^ (Signature[i] >> 8)) * 1099511628211ULL;
+  }
+
+  return Hash;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistMatcher::CHistMatcher(const CHistLib& HistLib, unsigned CacheSize) :
+  mHistLib(HistLib),
+  mCacheSize(16),
+  mSignatureSteps(4096),
+  mHasValueReference(false),
+  mHasBGRReference(false),
+  mHits(0),
+  mMisses(0)
+{
+  SetCacheSize(CacheSize);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+CHistMatcher::~CHistMatcher()
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistMatcher::SetReference(const MatND& Hist)
+{
+  SetReferenceCdf(Hist, mValueCdf);
+
+  mHasValueReference = true;
+  mValueCache.clear();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistMatcher::SetReference(
+  const MatND& HistB,
+  const MatND& HistG,
+  const MatND& HistR)
+{
+  SetReferenceCdf(HistB, mBGRCdf[0]);
+  SetReferenceCdf(HistG, mBGRCdf[1]);
+  SetReferenceCdf(HistR, mBGRCdf[2]);
+
+  mHasBGRReference = true;
+  mBGRCache.clear();
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts the reference image exactly (no float histogram in between)
+//-----------------------------------------------------------------------------
+void CHistMatcher::SetReferenceImage(const Mat& Image)
+{
+  const int Type = Image.type();
+
+  if ((Type != CV_8UC1) && (Type != CV_8UC3) && (Type != CV_8UC4))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistMatcher::SetReferenceImage");
+  }
+
+  CHistWorkspace::CBuffers& Buffers = *mWorkspace.mpBuffers;
+  const int BandCount = GetBandCount(Image, mHistLib.GetThreadCount());
+
+  unsigned Counts[3][HIST_LIB_LEVELS] = {{0}};
+  CountValue(Image, BandCount, Counts[0], &Buffers.ValueCounters);
+
+  if (!BuildCdf(Counts[0], mValueCdf))
+  {
+    CV_Error(CV_StsBadArg, "CHistMatcher::SetReferenceImage");
+  }
+
+  mHasValueReference = true;
+  mValueCache.clear();
+
+  if (Type == CV_8UC1)
+  {
+    return;
+  }
+
+  memset(Counts, 0, sizeof(Counts));
+  CountBGR(
+    Image,
+    BandCount,
+    Counts[0],
+    Counts[1],
+    Counts[2],
+    &Buffers.BGRCounters);
+
+  for (int c = 0; c < 3; ++c)
+  {
+    BuildCdf(Counts[c], mBGRCdf[c]);
+  }
+
+  mHasBGRReference = true;
+  mBGRCache.clear();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistMatcher::SetCacheSize(unsigned CacheSize)
+{
+  if (CacheSize > 0)
+  {
+    mCacheSize = CacheSize;
+    ClearCache();
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistMatcher::SetSignatureSteps(unsigned Steps)
+{
+  if ((Steps >= 16) && (Steps <= USHRT_MAX))
+  {
+    mSignatureSteps = Steps;
+    ClearCache();
+  }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistMatcher::GetCacheSize() const
+{
+  return mCacheSize;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+unsigned CHistMatcher::GetSignatureSteps() const
+{
+  return mSignatureSteps;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistMatcher::GetCacheStats(size_t& Hits, size_t& Misses) const
+{
+  Hits = mHits;
+  Misses = mMisses;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void CHistMatcher::ClearCache()
+{
+  mValueCache.clear();
+  mBGRCache.clear();
+  mHits = 0;
+  mMisses = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts the value channel, looks the mapping up by its signature (building
+//   it on a miss) and remaps the image
+//-----------------------------------------------------------------------------
+void CHistMatcher::MatchValue(const Mat& Image, Mat& ImageMatched)
+{
+  const int Type = Image.type();
+
+  if ((Type != CV_8UC1) && (Type != CV_8UC3) && (Type != CV_8UC4))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistMatcher::MatchValue");
+  }
+
+  if (!mHasValueReference)
+  {
+    CV_Error(CV_StsError, "CHistMatcher::MatchValue");
+  }
+
+  CHistWorkspace::CBuffers& Buffers = *mWorkspace.mpBuffers;
+  const int BandCount = GetBandCount(Image, mHistLib.GetThreadCount());
+
+  unsigned Counts[HIST_LIB_LEVELS] = {0};
+  CountValue(Image, BandCount, Counts, &Buffers.ValueCounters);
+
+  mSignature.resize(HIST_LIB_LEVELS);
+  BuildSignature(Counts, &mSignature[0]);
+
+  bool Found;
+  CEntry& Entry = FindEntry(mValueCache, mSignature, Found);
+
+  if (!Found)
+  {
+    BuildLut(&Entry.Signature[0], mValueCdf, Entry.Luts[0]);
+    BuildValueScales(Entry.Luts[0], Entry.Scales);
+  }
+
+  if (Type == CV_8UC1)
+  {
+    LUT(Image, Mat(1, HIST_LIB_LEVELS, CV_8U, Entry.Luts[0]), ImageMatched);
+  }
+  else
+  {
+    ApplyValueScales(Image, ImageMatched, Entry.Scales, BandCount);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Counts the three channels in one pass, looks the three mappings up by the
+//   joint signature and remaps the image with a single table lookup pass
+//-----------------------------------------------------------------------------
+void CHistMatcher::MatchBGR(const Mat& Image, Mat& ImageMatched)
+{
+  if ((Image.type() != CV_8UC3) && (Image.type() != CV_8UC4))
+  {
+    CV_Error(CV_StsUnsupportedFormat, "CHistMatcher::MatchBGR");
+  }
+
+  if (!mHasBGRReference)
+  {
+    CV_Error(CV_StsError, "CHistMatcher::MatchBGR");
+  }
+
+  CHistWorkspace::CBuffers& Buffers = *mWorkspace.mpBuffers;
+  const int BandCount = GetBandCount(Image, mHistLib.GetThreadCount());
+
+  unsigned Counts[3][HIST_LIB_LEVELS] = {{0}};
+  CountBGR(
+    Image,
+    BandCount,
+    Counts[0],
+    Counts[1],
+    Counts[2],
+    &Buffers.BGRCounters);
+
+  mSignature.resize(3 * HIST_LIB_LEVELS);
+  for (int c = 0; c < 3; ++c)
+  {
+    BuildSignature(Counts[c], &mSignature[c * HIST_LIB_LEVELS]);
+  }
+
+  bool Found;
+  CEntry& Entry = FindEntry(mBGRCache, mSignature, Found);
+
+  if (!Found)
+  {
+    for (int c = 0; c < 3; ++c)
+    {
+      BuildLut(
+        &Entry.Signature[c * HIST_LIB_LEVELS],
+        mBGRCdf[c],
+        Entry.Luts[c]);
+    }
+  }
+
+  // Interleaved table with the channel count of the image (alpha maps to
+  // itself)
+  const int Channels = Image.channels();
+  mLut.create(1, HIST_LIB_LEVELS, CV_8UC(Channels));
+
+  uchar* pLut = mLut.ptr<uchar>();
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    for (int c = 0; c < 3; ++c)
+    {
+      pLut[i * Channels + c] = Entry.Luts[c][i];
+    }
+
+    if (Channels == 4)
+    {
+      pLut[i * Channels + 3] = (uchar)i;
+    }
+  }
+
+  LUT(Image, mLut, ImageMatched);
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Converts a 256 bin CV_32F histogram into a reference CDF
+//-----------------------------------------------------------------------------
+void CHistMatcher::SetReferenceCdf(const MatND& Hist, double* pCdf)
+{
+  if ((Hist.type() != CV_32F) || (Hist.total() != HIST_LIB_LEVELS))
+  {
+    CV_Error(CV_StsBadArg, "CHistMatcher::SetReference");
+  }
+
+  double Values[HIST_LIB_LEVELS];
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Values[i] = Hist.at<float>(i);
+  }
+
+  if (!BuildCdf(Values, pCdf))
+  {
+    CV_Error(CV_StsBadArg, "CHistMatcher::SetReference");
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   The signature is the source CDF rounded to mSignatureSteps steps
+//-----------------------------------------------------------------------------
+void CHistMatcher::BuildSignature(
+  const unsigned* Counts,
+  ushort* pSignature) const
+{
+  uint64 Total = 0;
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Total += Counts[i];
+  }
+
+  uint64 Sum = 0;
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    Sum += Counts[i];
+    pSignature[i] = Total ?
+      (ushort)((Sum * mSignatureSteps + Total / 2) / Total) : 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Maps every source level to the lowest reference level whose CDF reaches
+//   the (quantized) source CDF.  Both CDFs are non-decreasing, so one merge
+//   style pass over the two arrays is enough.
+//-----------------------------------------------------------------------------
+void CHistMatcher::BuildLut(
+  const ushort* pSignature,
+  const double* pReferenceCdf,
+  uchar* pLut) const
+{
+  const double Tolerance = 0.5 / mSignatureSteps;
+  int Level = 0;
+
+  for (int i = 0; i < HIST_LIB_LEVELS; ++i)
+  {
+    const double Target = (double)pSignature[i] / mSignatureSteps - Tolerance;
+
+    while ((Level < HIST_LIB_LEVELS - 1) && (pReferenceCdf[Level] < Target))
+    {
+      ++Level;
+    }
+
+    pLut[i] = (uchar)Level;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Description:
+//   Returns the cached entry with the given signature, moved to the front of
+//   the cache.  On a miss the least recently used entry is evicted when the
+//   cache is full and a new entry (tables not yet built) is returned.
+//-----------------------------------------------------------------------------
+CHistMatcher::CEntry& CHistMatcher::FindEntry(
+  list<CEntry>& Cache,
+  const vector<ushort>& Signature,
+  bool& Found)
+{
+  const uint64 Hash = HashSignature(Signature);
+
+  for (list<CEntry>::iterator it = Cache.begin(); it != Cache.end(); ++it)
+  {
+    if ((it->Hash == Hash) && (it->Signature == Signature))
+    {
+      Cache.splice(Cache.begin(), Cache, it);
+      Found = true;
+      ++mHits;
+      return Cache.front();
+    }
+  }
+
+  while (Cache.size() >= mCacheSize)
+  {
+    Cache.pop_back();
+  }
+
+  Cache.push_front(CEntry());
+  Cache.front().Hash = Hash;
+  Cache.front().Signature = Signature;
+
+  Found = false;
+  ++mMisses;
+  return Cache.front();
+}
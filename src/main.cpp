@@ -30,6 +30,7 @@
 // ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //=============================================================================
 
+#include "histBatch.h"
 #include "histLib.h"
 #include <iostream>
 #include <opencv2/imgproc.hpp>
@@ -333,6 +334,46 @@ void LevelScalingNoEffect()
   }
 }
 
+//-----------------------------------------------------------------------------
+// Description:
+//  Verifies that a batch which fails on an unsupported image leaves the batch
+//  object usable.  The failing image is processed first, so the single worker
+//  stops with the rest of the batch still queued; the next (smaller) batch
+//  must only process its own image.
+//-----------------------------------------------------------------------------
+void BatchRecoversFromError()
+{
+  CHistLib Histogram;
+  CHistBatch Batch(Histogram, HIST_LIB_CHANNELS_BGR, 1);
+
+  vector<Mat> Images(4, Mat(16, 16, CV_8UC3, Scalar(10, 20, 30)));
+  Images[0] = Mat(32, 32, CV_8UC2, Scalar(0, 0));
+
+  vector<CHistBatchResult> Results;
+  bool Failed = false;
+
+  try
+  {
+    Batch.Process(Images, Results);
+  }
+  catch (const Exception&)
+  {
+    Failed = true;
+  }
+
+  vector<Mat> Small(1, Mat(8, 8, CV_8UC3, Scalar(10, 20, 30)));
+  Batch.Process(Small, Results);
+
+  const bool Recovered =
+    Failed &&
+    (Results.size() == 1) &&
+    (Results[0].Hists.size() == 3) &&
+    (sum(Results[0].Hists[0])[0] == Small[0].total());
+
+  cout << "Batch after a failed batch: "
+       << (Recovered ? "ok" : "FAILED") << endl;
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 int main(void)
@@ -362,5 +403,8 @@ int main(void)
   // at full contrast
   LevelScalingNoEffect();
 
+  // Verify that a failed batch does not leak jobs into the next one
+  BatchRecoversFromError();
+
   return 0;
 }